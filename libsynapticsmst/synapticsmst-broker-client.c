@@ -0,0 +1,119 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <gio/gunixsocketaddress.h>
+
+#include "synapticsmst-broker-client.h"
+
+/**
+ * synapticsmst_broker_get_socket_path:
+ *
+ * Gets the socket the broker listens on, which can be overridden with the
+ * SYNAPTICSMST_BROKER_SOCKET environment variable.
+ *
+ * Returns: a filename
+ **/
+const gchar *
+synapticsmst_broker_get_socket_path (void)
+{
+	const gchar *tmp = g_getenv ("SYNAPTICSMST_BROKER_SOCKET");
+	if (tmp != NULL)
+		return tmp;
+	return LOCALSTATEDIR "/run/synapticsmst/broker.sock";
+}
+
+/**
+ * synapticsmst_broker_is_running:
+ *
+ * Checks cheaply whether a broker might be listening, without connecting.
+ *
+ * Returns: %TRUE if the broker socket exists
+ **/
+gboolean
+synapticsmst_broker_is_running (void)
+{
+	return g_file_test (synapticsmst_broker_get_socket_path (), G_FILE_TEST_EXISTS);
+}
+
+/**
+ * synapticsmst_broker_request:
+ * @argv: the command and its arguments
+ * @output: a #GString the text printed by the command is appended to
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: a #GError or %NULL
+ *
+ * Runs a command in the broker. If the broker is not running the error is
+ * %G_IO_ERROR_NOT_FOUND or %G_IO_ERROR_CONNECTION_REFUSED, so the caller
+ * can fall back to doing the work itself.
+ *
+ * Returns: %TRUE if the command succeeded
+ **/
+gboolean
+synapticsmst_broker_request (gchar **argv, GString *output, GCancellable *cancellable, GError **error)
+{
+	g_autoptr(GSocketClient) client = g_socket_client_new ();
+	g_autoptr(GSocketAddress) address = g_unix_socket_address_new (synapticsmst_broker_get_socket_path ());
+	g_autoptr(GSocketConnection) connection = NULL;
+	g_autoptr(GDataInputStream) input = NULL;
+	g_autoptr(GString) request = g_string_new (NULL);
+	GOutputStream *ostream;
+
+	connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), cancellable, error);
+	if (connection == NULL)
+		return FALSE;
+
+	for (guint i = 0; argv[i] != NULL; i++) {
+		g_autofree gchar *quoted = g_shell_quote (argv[i]);
+		if (i > 0)
+			g_string_append_c (request, ' ');
+		g_string_append (request, quoted);
+	}
+	g_string_append_c (request, '\n');
+	ostream = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+	if (!g_output_stream_write_all (ostream, request->str, request->len, NULL, cancellable, error))
+		return FALSE;
+
+	input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+	for (;;) {
+		g_autofree gchar *line = g_data_input_stream_read_line (input, NULL, cancellable, error);
+		if (line == NULL) {
+			if (error != NULL && *error == NULL)
+				g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED, "Broker closed the connection\n");
+			return FALSE;
+		}
+		if (g_str_has_prefix (line, "I ")) {
+			g_string_append_printf (output, "%s\n", line + 2);
+			continue;
+		}
+		if (g_strcmp0 (line, "OK") == 0)
+			return TRUE;
+		if (g_str_has_prefix (line, "E ")) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s\n", line + 2);
+			return FALSE;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid reply from broker: %s\n", line);
+		return FALSE;
+	}
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __SYNAPTICSMST_BROKER_CLIENT_H
+#define __SYNAPTICSMST_BROKER_CLIENT_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* one request per connection: the client sends the command and its
+ * arguments as a single line of shell-quoted words, and the broker answers
+ * with "I <text>" lines followed by "OK" or "E <message>" */
+
+const gchar	*synapticsmst_broker_get_socket_path	(void);
+gboolean	 synapticsmst_broker_is_running		(void);
+gboolean	 synapticsmst_broker_request		(gchar			**argv,
+							 GString		*output,
+							 GCancellable		*cancellable,
+							 GError			**error);
+
+G_END_DECLS
+
+#endif /* __SYNAPTICSMST_BROKER_CLIENT_H */
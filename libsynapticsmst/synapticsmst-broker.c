@@ -0,0 +1,405 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario_limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "synapticsmst-broker-client.h"
+#include "synapticsmst-common.h"
+#include "synapticsmst-device.h"
+#include "synapticsmst-image.h"
+#include "synapticsmst-monitor.h"
+
+/* the broker owns the aux nodes for as long as it runs: the monitor keeps
+ * the topology, identities and board IDs cached, and requests run one at a
+ * time on the main loop so they never interleave on the AUX channel */
+
+typedef struct {
+	GMainLoop		*loop;
+	GSocketService		*service;
+	SynapticsMSTMonitor	*monitor;
+	gchar			*socket_path;
+} SynapticsMSTBroker;
+
+typedef struct {
+	SynapticsMSTBroker	*broker;
+	GSocketConnection	*connection;
+	GDataInputStream	*input;
+} SynapticsMSTBrokerClient;
+
+typedef gboolean (*SynapticsMSTBrokerFunc)	(SynapticsMSTBroker	*broker,
+						 gchar			**values,
+						 GString		*output,
+						 GError			**error);
+
+static void
+synapticsmst_broker_client_free (SynapticsMSTBrokerClient *client)
+{
+	g_object_unref (client->input);
+	g_object_unref (client->connection);
+	g_free (client);
+}
+
+static GPtrArray *
+synapticsmst_broker_get_devices (SynapticsMSTBroker *broker, GError **error)
+{
+	g_autoptr(GPtrArray) devices = synapticsmst_monitor_get_devices (broker->monitor);
+
+	if (devices->len == 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No Synaptics MST Device Found\n");
+		return NULL;
+	}
+	/* the same order synapticsmst-tool indexes devices in */
+	synapticsmst_device_sort_by_route (devices);
+
+	/* identities are cached, so this costs nothing after the first time */
+	return synapticsmst_device_dedupe (devices, NULL, error);
+}
+
+static SynapticsMSTDevice *
+synapticsmst_broker_get_device (SynapticsMSTBroker *broker, const gchar *index, GError **error)
+{
+	g_autoptr(GPtrArray) devices = NULL;
+	guint64 device_index;
+
+	if (index == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected DEVICE-INDEX\n");
+		return NULL;
+	}
+	devices = synapticsmst_broker_get_devices (broker, error);
+	if (devices == NULL)
+		return NULL;
+	device_index = g_ascii_strtoull (index, NULL, 10);
+	if (device_index == 0 || device_index > devices->len) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid device index %s\n", index);
+		return NULL;
+	}
+	return g_object_ref (g_ptr_array_index (devices, device_index - 1));
+}
+
+static gboolean
+synapticsmst_broker_enumerate (SynapticsMSTBroker *broker, gchar **values, GString *output, GError **error)
+{
+	g_autoptr(GPtrArray) devices = synapticsmst_broker_get_devices (broker, error);
+
+	if (devices == NULL)
+		return FALSE;
+	g_string_append (output, "\nMST Devices :\n");
+	for (guint i = 0; i < devices->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (devices, i);
+		const gchar *boardID = synapticsmst_device_boardID_to_string (synapticsmst_device_get_boardID (device));
+
+		g_string_append_printf (output, "[Device %1u]\n", i + 1);
+		if (boardID != NULL) {
+			g_string_append_printf (output, "Device : %s with Synaptics %s\n", boardID, synapticsmst_device_get_chipID (device));
+			g_string_append_printf (output, "Connect Type : %s in DP Aux Node %d\n",
+						synapticsmst_device_kind_to_string (synapticsmst_device_get_kind (device)),
+						synapticsmst_device_get_aux_node (device));
+			g_string_append_printf (output, "Firmware version : %s\n", synapticsmst_device_get_version (device));
+		}
+		else {
+			g_string_append (output, "Unknown Device\n");
+		}
+		g_string_append (output, "\n");
+	}
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_broker_checksum (SynapticsMSTBroker *broker, gchar **values, GString *output, GError **error)
+{
+	g_autoptr(SynapticsMSTDevice) device = synapticsmst_broker_get_device (broker, values[0], error);
+	guint32 checksum = 0;
+
+	if (device == NULL)
+		return FALSE;
+	if (!synapticsmst_device_get_flash_checksum (device, SYNAPTICSMST_IMAGE_MAX_SIZE, 0, &checksum, error))
+		return FALSE;
+	g_string_append_printf (output, "0x%08x\n", checksum);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_broker_audit (SynapticsMSTBroker *broker, gchar **values, GString *output, GError **error)
+{
+	g_autoptr(GPtrArray) devices = synapticsmst_broker_get_devices (broker, error);
+	guint n_failed = 0;
+
+	if (devices == NULL)
+		return FALSE;
+	for (guint i = 0; i < devices->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (devices, i);
+		g_autoptr(GError) error_local = NULL;
+		guint32 checksum = 0;
+
+		g_string_append_printf (output, "[Device %1u] aux node %u layer %u rad 0x%04x: ", i + 1,
+					synapticsmst_device_get_aux_node (device),
+					synapticsmst_device_get_layer (device),
+					synapticsmst_device_get_rad (device));
+		if (!synapticsmst_device_audit (device, &checksum, NULL, &error_local)) {
+			g_string_append (output, error_local->message);
+			n_failed++;
+			continue;
+		}
+		g_string_append_printf (output, "%s %s board 0x%04x checksum 0x%08x\n",
+					synapticsmst_device_get_chipID (device),
+					synapticsmst_device_get_version (device),
+					synapticsmst_device_get_boardID (device),
+					checksum);
+	}
+	if (n_failed > 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to audit %u devices\n", n_failed);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_broker_flash (SynapticsMSTBroker *broker, gchar **values, GString *output, GError **error)
+{
+	g_autoptr(SynapticsMSTDevice) device = NULL;
+	g_autoptr(GBytes) fw = NULL;
+	gchar *data = NULL;
+	gsize len;
+
+	if (values[0] == NULL || values[1] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected FILE DEVICE-INDEX\n");
+		return FALSE;
+	}
+	if (!g_path_is_absolute (values[0])) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Firmware path %s is not absolute\n", values[0]);
+		return FALSE;
+	}
+	device = synapticsmst_broker_get_device (broker, values[1], error);
+	if (device == NULL)
+		return FALSE;
+	if (synapticsmst_device_boardID_to_string (synapticsmst_device_get_boardID (device)) == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : unknown device\n");
+		return FALSE;
+	}
+	if (!g_file_get_contents (values[0], &data, &len, error))
+		return FALSE;
+	fw = g_bytes_new_take (data, len);
+	if (!synapticsmst_device_write_firmware (device, fw, error))
+		return FALSE;
+	g_string_append (output, "Update Sucessfully. Please reset device to apply new firmware\n");
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_broker_rescan (SynapticsMSTBroker *broker, gchar **values, GString *output, GError **error)
+{
+	return synapticsmst_monitor_coldplug (broker->monitor, error);
+}
+
+static const struct {
+	const gchar		*name;
+	SynapticsMSTBrokerFunc	 func;
+} synapticsmst_broker_commands[] = {
+	{ "enumerate",	synapticsmst_broker_enumerate },
+	{ "checksum",	synapticsmst_broker_checksum },
+	{ "audit",	synapticsmst_broker_audit },
+	{ "flash",	synapticsmst_broker_flash },
+	{ "rescan",	synapticsmst_broker_rescan },
+	{ NULL,		NULL }
+};
+
+static gboolean
+synapticsmst_broker_run (SynapticsMSTBroker *broker, const gchar *request, GString *output, GError **error)
+{
+	g_auto(GStrv) argv = NULL;
+
+	if (!g_shell_parse_argv (request, NULL, &argv, error))
+		return FALSE;
+	for (guint i = 0; synapticsmst_broker_commands[i].name != NULL; i++) {
+		if (g_strcmp0 (argv[0], synapticsmst_broker_commands[i].name) == 0)
+			return synapticsmst_broker_commands[i].func (broker, &argv[1], output, error);
+	}
+	g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Command %s not supported by the broker\n", argv[0]);
+	return FALSE;
+}
+
+static void
+synapticsmst_broker_read_line_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SynapticsMSTBrokerClient *client = (SynapticsMSTBrokerClient *) user_data;
+	g_autoptr(GString) output = g_string_new (NULL);
+	g_autoptr(GString) reply = g_string_new (NULL);
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GError) error_write = NULL;
+	g_autofree gchar *request = NULL;
+	g_auto(GStrv) lines = NULL;
+	GOutputStream *ostream;
+	gboolean ret;
+
+	request = g_data_input_stream_read_line_finish (client->input, res, NULL, &error);
+	if (request == NULL) {
+		if (error != NULL)
+			g_debug ("failed to read request: %s", error->message);
+		synapticsmst_broker_client_free (client);
+		return;
+	}
+
+	g_debug ("running %s", request);
+	ret = synapticsmst_broker_run (client->broker, request, output, &error);
+
+	/* prefix each line so the reply cannot be confused with the status */
+	lines = g_strsplit (output->str, "\n", -1);
+	for (guint i = 0; lines[i] != NULL; i++) {
+		if (lines[i + 1] == NULL && lines[i][0] == '\0')
+			break;
+		g_string_append_printf (reply, "I %s\n", lines[i]);
+	}
+	if (ret) {
+		g_string_append (reply, "OK\n");
+	}
+	else {
+		g_strchomp (error->message);
+		g_strdelimit (error->message, "\n", ' ');
+		g_string_append_printf (reply, "E %s\n", error->message);
+	}
+	ostream = g_io_stream_get_output_stream (G_IO_STREAM (client->connection));
+	if (!g_output_stream_write_all (ostream, reply->str, reply->len, NULL, NULL, &error_write))
+		g_debug ("failed to send reply: %s", error_write->message);
+	synapticsmst_broker_client_free (client);
+}
+
+static gboolean
+synapticsmst_broker_incoming_cb (GSocketService *service,
+				 GSocketConnection *connection,
+				 GObject *source_object,
+				 gpointer user_data)
+{
+	SynapticsMSTBrokerClient *client = g_new0 (SynapticsMSTBrokerClient, 1);
+
+	client->broker = (SynapticsMSTBroker *) user_data;
+	client->connection = g_object_ref (connection);
+	client->input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+	g_data_input_stream_read_line_async (client->input, G_PRIORITY_DEFAULT, NULL,
+					     synapticsmst_broker_read_line_cb, client);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_broker_listen (SynapticsMSTBroker *broker, GError **error)
+{
+	g_autofree gchar *dirname = g_path_get_dirname (broker->socket_path);
+	g_autoptr(GSocketAddress) address = NULL;
+	mode_t old_umask;
+	gboolean ret;
+
+	if (g_mkdir_with_parents (dirname, 0755) != 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create %s\n", dirname);
+		return FALSE;
+	}
+
+	/* a socket left by a broker that crashed would make the bind fail */
+	if (g_unlink (broker->socket_path) != 0 && errno != ENOENT) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to remove %s: %s\n",
+			     broker->socket_path, g_strerror (errno));
+		return FALSE;
+	}
+	address = g_unix_socket_address_new (broker->socket_path);
+	broker->service = g_socket_service_new ();
+
+	/* flashing needs root anyway, and only root may talk to us; the socket
+	 * is created 0600 so it is never reachable by anyone else */
+	old_umask = umask (0177);
+	ret = g_socket_listener_add_address (G_SOCKET_LISTENER (broker->service), address,
+					     G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+					     NULL, NULL, error);
+	umask (old_umask);
+	if (!ret)
+		return FALSE;
+	g_signal_connect (broker->service, "incoming",
+			  G_CALLBACK (synapticsmst_broker_incoming_cb), broker);
+	g_socket_service_start (broker->service);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_broker_quit_cb (gpointer user_data)
+{
+	SynapticsMSTBroker *broker = (SynapticsMSTBroker *) user_data;
+	g_main_loop_quit (broker->loop);
+	return G_SOURCE_REMOVE;
+}
+
+int
+main (int argc, char **argv)
+{
+	SynapticsMSTBroker broker = { NULL };
+	gboolean verbose = FALSE;
+	g_autofree gchar *socket_path = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GOptionContext) context = NULL;
+	const GOptionEntry options[] = {
+		{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+			"Print verbose debug statements", NULL },
+		{ "socket", '\0', 0, G_OPTION_ARG_FILENAME, &socket_path,
+			"Listen on a different Unix socket", "FILE" },
+		{ NULL}
+	};
+
+	context = g_option_context_new (NULL);
+	g_option_context_set_summary (context, "Serve synapticsmst-tool requests from warm sessions");
+	g_option_context_add_main_entries (context, options, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse arguments: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	if (verbose)
+		g_setenv ("G_MESSAGES_DEBUG", "all", FALSE);
+
+	/* scan once, then follow hotplug instead of rescanning per request */
+	broker.socket_path = g_strdup (socket_path != NULL ? socket_path : synapticsmst_broker_get_socket_path ());
+	broker.loop = g_main_loop_new (NULL, FALSE);
+	broker.monitor = synapticsmst_monitor_new ();
+	if (!synapticsmst_monitor_coldplug (broker.monitor, &error)) {
+		g_printerr ("%s", error->message);
+		return EXIT_FAILURE;
+	}
+	if (!synapticsmst_broker_listen (&broker, &error)) {
+		g_printerr ("%s", error->message);
+		return EXIT_FAILURE;
+	}
+	g_unix_signal_add (SIGINT, synapticsmst_broker_quit_cb, &broker);
+	g_unix_signal_add (SIGTERM, synapticsmst_broker_quit_cb, &broker);
+	g_debug ("listening on %s", broker.socket_path);
+	g_main_loop_run (broker.loop);
+
+	g_socket_service_stop (broker.service);
+	g_unlink (broker.socket_path);
+	g_object_unref (broker.service);
+	g_object_unref (broker.monitor);
+	g_main_loop_unref (broker.loop);
+	g_free (broker.socket_path);
+	return EXIT_SUCCESS;
+}
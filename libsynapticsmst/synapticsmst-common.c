@@ -21,26 +21,349 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* F_OFD_SETLK */
+#endif
+
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <pthread.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 #include "synapticsmst-common.h"
+#include "synapticsmst-emulator.h"
 
-#define UNIT_SIZE       32
-#define MAX_WAIT_TIME   3  /* unit : second */
+#define UNIT_SIZE       32  /* size of the RC data window */
+#define MAX_WAIT_TIME   3000  /* unit : millisecond */
+#define POLL_INTERVAL   500  /* unit : microsecond */
+#define RC_SEND_DATA    0x01
+#define RC_SEND_OFFSET  0x02
+#define RC_SEND_LEN     0x04
+#define LOCK_TIMEOUT    10000  /* unit : millisecond */
+#define LOCK_TURNSTILE  0  /* byte held by a waiting writer to hold back new readers */
+#define LOCK_DATA       1  /* byte held shared by readers or exclusively by a writer */
+#define BUDGET_BURST    100  /* unit : millisecond of budget that may be spent at once */
+#define RC_STATE_ENABLED 0x01  /* REG_RC_STATE bit, remote control is on, checked per hub */
+#define STUCK_POLLS     3  /* polls with remote control off before a command is given up */
+#define RC_OP_FIXED     0x01  /* a single command of the shape in g_rc_opcodes */
+#define RC_OP_BULK      0x02  /* a range moved through REG_RC_DATA in unit_size chunks */
+#define RC_OP_DATA      0x04  /* sends a payload through REG_RC_DATA */
+#define RC_OP_REPLY     0x08  /* answers through REG_RC_DATA */
+#define RC_OP_EEPROM    0x10  /* may change the EEPROM */
+#define RC_OPCODES      0x40
+
+/* open file description locks are released when the fd is closed, and unlike
+ * classic POSIX locks are not shared between the opens made by one process */
+#ifndef F_OFD_SETLK
+#define F_OFD_SETLK     F_SETLK
+#endif
 
 int g_fd = 0;
 unsigned char g_layer = 0;
 unsigned char g_remain_layer = 0;
 unsigned int g_RAD = 0;
 
+/* the connection state above is shared, so only one user at a time;
+ * recursive, set up once by synapticsmst_common_mutex_init() */
+static pthread_once_t g_mutex_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_mutex;
+static synapticsmst_transport g_transport = { UNIT_SIZE, MAX_WAIT_TIME, POLL_INTERVAL, 0 };
+static synapticsmst_stats g_stats = { 0, 0, 0, 0 };
+static int g_lock_timeout = LOCK_TIMEOUT;
+static int g_lock_type = F_UNLCK;
+static struct {
+    synapticsmst_budget budget;
+    double transactions;    /* tokens left, negative while in debt */
+    double bytes;
+    long long refilled;     /* unit : microsecond */
+} g_buckets[TRAFFIC_CLASSES];
+static synapticsmst_traffic g_traffic = TRAFFIC_BACKGROUND;
+#define MAX_FAULT_SCRIPT 32
+
+typedef enum {
+    FAULT_NONE = 0,
+    FAULT_AUX,
+    FAULT_RC,
+    FAULT_DELAY,
+    FAULT_STUCK,
+}fault_kind;
+
+static int g_emulated = 0;
+static int g_faults_enabled = 0;
+static synapticsmst_faults g_faults;
+static unsigned int g_fault_rand = 1;
+static unsigned int g_fault_aux_count = 0;
+static unsigned int g_fault_rc_count = 0;
+static struct {
+    fault_kind kind;
+    unsigned int count;
+} g_fault_script[MAX_FAULT_SCRIPT];
+static int g_fault_script_len = 0;
+
+#ifdef HAVE_LIBURING
+/* only coalesces the mailbox writes that start a command on the current
+ * connection; completion polls still use plain reads, and there is one
+ * connection at a time, so this does not drive several hubs at once */
+#define RING_ENTRIES    8
+static struct io_uring g_ring;
+static int g_ring_state = 0;  /* 0 : untried, 1 : ready, -1 : unavailable */
+#endif
+static synapticsmst_cancel_func g_cancel_func = NULL;
+static void *g_cancel_data = NULL;
+static synapticsmst_write_func g_write_func = NULL;
+static void *g_write_data = NULL;
+static char g_filename[256];
+static unsigned int g_rc_state_known = 0;  /* depths where RC_STATE_ENABLED was seen after ENABLE_RC */
+static struct {
+    int valid;
+    unsigned char layer;
+    unsigned int RAD;
+    int offset;                         /* last written to REG_RC_OFFSET */
+    int length;                         /* last written to REG_RC_LEN */
+} g_mailbox;                            /* only trusted by rc_run_list */
+static int g_rc_started = 0;            /* command left running by rc_start_command */
+static long long g_rc_started_at = 0;   /* unit : microsecond */
+
+/* the shape of every RC command this library sends; opcodes missing here are
+ * sent as bulk transfers of whatever the caller asks for */
+static const struct {
+    unsigned char flags;
+    unsigned char data_length;  /* fixed payload, also written to REG_RC_LEN */
+    unsigned char reply_length; /* fixed reply */
+    unsigned char wait_time;    /* typical completion, polling starts after it, unit : millisecond */
+} g_rc_opcodes[RC_OPCODES] = {
+    [UPDC_ENABLE_RC]                = { RC_OP_FIXED | RC_OP_DATA, 5, 0, 0 },
+    [UPDC_DISABLE_RC]               = { RC_OP_FIXED, 0, 0, 0 },
+    [UPDC_ENABLE_FLASH_CHIP_ERASE]  = { RC_OP_FIXED | RC_OP_EEPROM, 0, 0, 0 },
+    [UPDC_CAL_EEPROM_CHECKSUM]      = { RC_OP_FIXED | RC_OP_REPLY, 0, 4, 0 },
+    [UPDC_FLASH_ERASE]              = { RC_OP_FIXED | RC_OP_DATA | RC_OP_EEPROM, 2, 0, 20 },
+    [UPDC_CAL_EEPROM_CHECK_CRC8]    = { RC_OP_FIXED | RC_OP_REPLY, 0, 4, 0 },
+    [UPDC_CAL_EEPROM_CHECK_CRC16]   = { RC_OP_FIXED | RC_OP_REPLY, 0, 4, 0 },
+    [UPDC_WRITE_TO_EEPROM]          = { RC_OP_BULK | RC_OP_DATA | RC_OP_EEPROM, 0, 0, 0 },
+    [UPDC_WRITE_TO_MEMORY]          = { RC_OP_BULK | RC_OP_DATA, 0, 0, 0 },
+    [UPDC_WRITE_TO_TX_DPCD]         = { RC_OP_BULK | RC_OP_DATA, 0, 0, 0 },
+    [UPDC_WRITE_TO_TX_DPCD + 1]     = { RC_OP_BULK | RC_OP_DATA, 0, 0, 0 },
+    [UPDC_WRITE_TO_TX_DPCD + 2]     = { RC_OP_BULK | RC_OP_DATA, 0, 0, 0 },
+    [UPDC_WRITE_TO_TX_DPCD + 3]     = { RC_OP_BULK | RC_OP_DATA, 0, 0, 0 },
+    [UPDC_READ_FROM_EEPROM]         = { RC_OP_BULK | RC_OP_REPLY, 0, 0, 0 },
+    [UPDC_READ_FROM_TX_DPCD]        = { RC_OP_BULK | RC_OP_REPLY, 0, 0, 0 },
+    [UPDC_READ_FROM_TX_DPCD + 1]    = { RC_OP_BULK | RC_OP_REPLY, 0, 0, 0 },
+    [UPDC_READ_FROM_TX_DPCD + 2]    = { RC_OP_BULK | RC_OP_REPLY, 0, 0, 0 },
+    [UPDC_READ_FROM_TX_DPCD + 3]    = { RC_OP_BULK | RC_OP_REPLY, 0, 0, 0 },
+};
+
+/* xorshift32, so a seed replays the same faults on every run */
+static unsigned int
+synapticsmst_common_fault_rand (void)
+{
+    g_fault_rand ^= g_fault_rand << 13;
+    g_fault_rand ^= g_fault_rand >> 17;
+    g_fault_rand ^= g_fault_rand << 5;
+    return g_fault_rand;
+}
+
+static int
+synapticsmst_common_fault_chance (int per_mille)
+{
+    return per_mille > 0 && (int)(synapticsmst_common_fault_rand () % 1000) < per_mille;
+}
+
+static int
+synapticsmst_common_fault_scripted (fault_kind kind, unsigned int count)
+{
+    for (int i = 0; i < g_fault_script_len; i++) {
+        if (g_fault_script[i].kind == kind && g_fault_script[i].count == count) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* faults only ever apply to an emulated hub, never to real hardware */
+static int
+synapticsmst_common_inject_aux (void)
+{
+    struct timespec t_latency;
+
+    if (!g_faults_enabled || !g_emulated) {
+        return 0;
+    }
+    g_fault_aux_count++;
+    if (g_faults.aux_latency > 0) {
+        t_latency.tv_sec = g_faults.aux_latency / 1000000;
+        t_latency.tv_nsec = (g_faults.aux_latency % 1000000) * 1000L;
+        nanosleep (&t_latency, NULL);
+    }
+    return synapticsmst_common_fault_scripted (FAULT_AUX, g_fault_aux_count) ||
+           synapticsmst_common_fault_chance (g_faults.aux_fail);
+}
+
+static fault_kind
+synapticsmst_common_inject_rc (void)
+{
+    if (!g_faults_enabled || !g_emulated) {
+        return FAULT_NONE;
+    }
+    g_fault_rc_count++;
+    for (fault_kind kind = FAULT_RC; kind <= FAULT_STUCK; kind++) {
+        if (synapticsmst_common_fault_scripted (kind, g_fault_rc_count)) {
+            return kind;
+        }
+    }
+    if (synapticsmst_common_fault_chance (g_faults.rc_stuck)) {
+        return FAULT_STUCK;
+    }
+    if (synapticsmst_common_fault_chance (g_faults.rc_delay)) {
+        return FAULT_DELAY;
+    }
+    if (synapticsmst_common_fault_chance (g_faults.rc_fail)) {
+        return FAULT_RC;
+    }
+    return FAULT_NONE;
+}
+
+void
+synapticsmst_common_set_faults (const synapticsmst_faults *faults)
+{
+    const char *p;
+
+    g_fault_script_len = 0;
+    g_fault_aux_count = 0;
+    g_fault_rc_count = 0;
+    if (faults == NULL) {
+        g_faults_enabled = 0;
+        return;
+    }
+
+    g_faults = *faults;
+    g_faults.script = NULL;
+    g_fault_rand = faults->seed ? faults->seed : 1;
+
+    /* "aux@12,rc@40" fails the 12th AUX access and the 40th RC command */
+    for (p = faults->script; p != NULL && *p != '\0' && g_fault_script_len < MAX_FAULT_SCRIPT; ) {
+        fault_kind kind = FAULT_NONE;
+        char *end;
+
+        if (strncmp (p, "aux@", 4) == 0) {
+            kind = FAULT_AUX;
+        }
+        else if (strncmp (p, "rc@", 3) == 0) {
+            kind = FAULT_RC;
+        }
+        else if (strncmp (p, "delay@", 6) == 0) {
+            kind = FAULT_DELAY;
+        }
+        else if (strncmp (p, "stuck@", 6) == 0) {
+            kind = FAULT_STUCK;
+        }
+        p = strchr (p, '@');
+        if (kind == FAULT_NONE || p == NULL) {
+            break;
+        }
+        g_fault_script[g_fault_script_len].kind = kind;
+        g_fault_script[g_fault_script_len++].count = strtoul (p + 1, &end, 10);
+        p = (*end == ',') ? end + 1 : end;
+    }
+    g_faults_enabled = 1;
+}
+
+static long long
+synapticsmst_common_get_time_us (void)
+{
+    struct timespec t_spec;
+
+    clock_gettime (CLOCK_MONOTONIC, &t_spec);
+    return t_spec.tv_sec * 1000000LL + t_spec.tv_nsec / 1000;
+}
+
+void
+synapticsmst_common_set_budget (synapticsmst_traffic traffic, const synapticsmst_budget *budget)
+{
+    if (traffic < 0 || traffic >= TRAFFIC_CLASSES) {
+        return;
+    }
+    g_buckets[traffic].budget.transactions = budget ? budget->transactions : 0;
+    g_buckets[traffic].budget.bytes = budget ? budget->bytes : 0;
+
+    /* start with a full burst */
+    g_buckets[traffic].transactions = g_buckets[traffic].budget.transactions * BUDGET_BURST / 1000.0;
+    g_buckets[traffic].bytes = g_buckets[traffic].budget.bytes * BUDGET_BURST / 1000.0;
+    g_buckets[traffic].refilled = synapticsmst_common_get_time_us ();
+}
+
+void
+synapticsmst_common_set_traffic (synapticsmst_traffic traffic)
+{
+    if (traffic >= 0 && traffic < TRAFFIC_CLASSES) {
+        g_traffic = traffic;
+    }
+}
+
+/* token bucket per traffic class; an access larger than the burst puts the
+ * bucket in debt, and the caller sleeps until the debt is paid off */
+static void
+synapticsmst_common_throttle (int transactions, int bytes)
+{
+    const synapticsmst_budget *budget = &g_buckets[g_traffic].budget;
+    long long now;
+    double elapsed;
+    double wait = 0;
+    struct timespec t_wait;
+
+    if (budget->transactions <= 0 && budget->bytes <= 0) {
+        return;
+    }
+
+    now = synapticsmst_common_get_time_us ();
+    elapsed = (now - g_buckets[g_traffic].refilled) / 1000000.0;
+    g_buckets[g_traffic].refilled = now;
+    if (budget->transactions > 0) {
+        double burst = budget->transactions * BUDGET_BURST / 1000.0;
+        double tokens = g_buckets[g_traffic].transactions + elapsed * budget->transactions;
+        tokens = (tokens > burst ? burst : tokens) - transactions;
+        if (tokens < 0 && -tokens / budget->transactions > wait) {
+            wait = -tokens / budget->transactions;
+        }
+        g_buckets[g_traffic].transactions = tokens;
+    }
+    if (budget->bytes > 0) {
+        double burst = budget->bytes * BUDGET_BURST / 1000.0;
+        double tokens = g_buckets[g_traffic].bytes + elapsed * budget->bytes;
+        tokens = (tokens > burst ? burst : tokens) - bytes;
+        if (tokens < 0 && -tokens / budget->bytes > wait) {
+            wait = -tokens / budget->bytes;
+        }
+        g_buckets[g_traffic].bytes = tokens;
+    }
+
+    if (wait > 0) {
+        t_wait.tv_sec = (time_t) wait;
+        t_wait.tv_nsec = (long) ((wait - t_wait.tv_sec) * 1000000000.0);
+        nanosleep (&t_wait, NULL);
+        g_stats.throttled_us += (unsigned long) (wait * 1000000.0);
+    }
+}
+
 static unsigned char
 synapticsmst_common_aux_node_read (int offset, int *buf, int length)
 {
+    synapticsmst_common_throttle (1, length);
+    if (synapticsmst_common_inject_aux ()) {
+        return DPCD_ACCESS_FAIL;
+    }
+    if (g_emulated) {
+        return synapticsmst_emulator_read (offset, (unsigned char *)buf, length);
+    }
+
     if (lseek (g_fd, offset, SEEK_SET) != offset) {
         return DPCD_SEEK_FAIL;
     }
@@ -55,6 +378,14 @@ synapticsmst_common_aux_node_read (int offset, int *buf, int length)
 static unsigned char
 synapticsmst_common_aux_node_write (int offset, int *buf, int length)
 {
+    synapticsmst_common_throttle (1, length);
+    if (synapticsmst_common_inject_aux ()) {
+        return DPCD_ACCESS_FAIL;
+    }
+    if (g_emulated) {
+        return synapticsmst_emulator_write (offset, (const unsigned char *)buf, length);
+    }
+
     if (lseek (g_fd, offset, SEEK_SET) != offset) {
         return DPCD_SEEK_FAIL;
     }
@@ -66,17 +397,165 @@ synapticsmst_common_aux_node_write (int offset, int *buf, int length)
     return DPCD_SUCCESS;
 }
 
+static int
+synapticsmst_common_set_lock (int type, int start)
+{
+    struct flock fl;
+
+    memset (&fl, 0, sizeof (fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = 1;
+    return fcntl (g_fd, F_OFD_SETLK, &fl);
+}
+
+static int
+synapticsmst_common_wait_lock (int type, int start, const struct timespec *deadline)
+{
+    struct timespec t_spec;
+    struct timespec t_poll = { 0, 1000000 };
+
+    while (synapticsmst_common_set_lock (type, start) != 0) {
+        if (errno != EAGAIN && errno != EACCES) {
+            return -1;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &t_spec);
+        if (t_spec.tv_sec > deadline->tv_sec ||
+            (t_spec.tv_sec == deadline->tv_sec && t_spec.tv_nsec >= deadline->tv_nsec)) {
+            return -1;
+        }
+        nanosleep (&t_poll, NULL);
+
+        /* back off up to 64ms so a long flash is not hammered with fcntl() */
+        if (t_poll.tv_nsec < 64000000) {
+            t_poll.tv_nsec *= 2;
+        }
+    }
+
+    return 0;
+}
+
+void
+synapticsmst_common_set_transport (const synapticsmst_transport *transport)
+{
+    if (transport == NULL) {
+        g_transport.unit_size = UNIT_SIZE;
+        g_transport.max_wait_time = MAX_WAIT_TIME;
+        g_transport.poll_interval = POLL_INTERVAL;
+        g_transport.no_recovery = 0;
+        return;
+    }
+
+    g_transport = *transport;
+    if (g_transport.unit_size <= 0 || g_transport.unit_size > UNIT_SIZE) {
+        g_transport.unit_size = UNIT_SIZE;
+    }
+    if (g_transport.max_wait_time <= 0) {
+        g_transport.max_wait_time = MAX_WAIT_TIME;
+    }
+    if (g_transport.poll_interval <= 0 || g_transport.poll_interval >= 1000000) {
+        g_transport.poll_interval = POLL_INTERVAL;
+    }
+}
+
+void
+synapticsmst_common_get_transport (synapticsmst_transport *transport)
+{
+    *transport = g_transport;
+}
+
+void
+synapticsmst_common_get_stats (synapticsmst_stats *stats)
+{
+    *stats = g_stats;
+}
+
+void
+synapticsmst_common_set_lock_timeout (int timeout_ms)
+{
+    g_lock_timeout = timeout_ms;
+}
+
+unsigned char
+synapticsmst_common_lock_aux_node (int exclusive)
+{
+    struct timespec deadline;
+    int type = exclusive ? F_WRLCK : F_RDLCK;
+    int nRet;
+
+    if (g_emulated) {
+        return DPCD_SUCCESS;
+    }
+    if (g_lock_type == type || (g_lock_type == F_WRLCK && !exclusive)) {
+        return DPCD_SUCCESS;
+    }
+
+    /* never upgrade in place: two readers upgrading at once would wait on
+     * each other until the timeout, so queue up again from scratch */
+    if (g_lock_type != F_UNLCK) {
+        synapticsmst_common_set_lock (F_UNLCK, LOCK_DATA);
+        g_lock_type = F_UNLCK;
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += g_lock_timeout / 1000;
+    deadline.tv_nsec += (g_lock_timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    /* a writer holds the turnstile while it waits for the readers to drain,
+     * so a steady stream of readers cannot starve a flash */
+    if (synapticsmst_common_wait_lock (type, LOCK_TURNSTILE, &deadline)) {
+        return DPCD_BUSY;
+    }
+    nRet = synapticsmst_common_wait_lock (type, LOCK_DATA, &deadline);
+    synapticsmst_common_set_lock (F_UNLCK, LOCK_TURNSTILE);
+    if (nRet) {
+        return DPCD_BUSY;
+    }
+
+    g_lock_type = type;
+    return DPCD_SUCCESS;
+}
+
+static void
+synapticsmst_common_mutex_init (void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init (&g_mutex, &attr);
+    pthread_mutexattr_destroy (&attr);
+}
+
 int
 synapticsmst_common_open_aux_node (const char* filename)
 {
     unsigned char byte[4];
-    g_fd = open (filename, O_RDWR);
+
+    pthread_once (&g_mutex_once, synapticsmst_common_mutex_init);
+    pthread_mutex_lock (&g_mutex);
+    g_emulated = synapticsmst_emulator_is_attached (filename);
+    g_fd = g_emulated ? 0 : open (filename, O_RDWR);
 
     if (g_fd != -1) {
+        /* probing only reads plain DPCD, so other readers may share the node */
+        if (synapticsmst_common_lock_aux_node (0) != DPCD_SUCCESS) {
+            close (g_fd);
+            g_fd = 0;
+            g_lock_type = F_UNLCK;
+            pthread_mutex_unlock (&g_mutex);
+            return -2;
+        }
         if (synapticsmst_common_aux_node_read (REG_RC_CAP, (int *)byte, 1) == DPCD_SUCCESS) {
             if (byte[0] & 0x04) {
                 synapticsmst_common_aux_node_read (REG_VENDOR_ID, (int *)byte, 3);
                 if (byte[0] == 0x90 && byte[1] == 0xCC && byte[2] == 0x24) {
+                    snprintf (g_filename, sizeof (g_filename), "%s", filename);
                     return 1;
                 }
             }
@@ -84,18 +563,211 @@ synapticsmst_common_open_aux_node (const char* filename)
     }
     else {
         /* can't open aux node, try use sudo to get the permission */
+        int saved_errno = errno;
+
+        g_fd = 0;
+        pthread_mutex_unlock (&g_mutex);
+        errno = saved_errno;
         return -1;
     }
 
-
+    if (!g_emulated) {
+        close (g_fd);
+    }
     g_fd = 0;
+    g_emulated = 0;
+    g_lock_type = F_UNLCK;
+    pthread_mutex_unlock (&g_mutex);
     return 0;
 }
 
 void
 synapticsmst_common_close_aux_node (void)
 {
-    close (g_fd);
+    /* closing the fd drops the advisory locks too */
+    if (!g_emulated) {
+        close (g_fd);
+    }
+    g_fd = 0;
+    g_emulated = 0;
+    g_lock_type = F_UNLCK;
+    g_traffic = TRAFFIC_BACKGROUND;
+    synapticsmst_common_set_transport (NULL);
+    g_cancel_func = NULL;
+    g_cancel_data = NULL;
+    g_filename[0] = '\0';
+    g_rc_state_known = 0;
+    g_mailbox.valid = 0;
+    g_rc_started = 0;
+#ifdef HAVE_LIBURING
+    /* the ring is set up again for the next aux node */
+    if (g_ring_state > 0) {
+        io_uring_queue_exit (&g_ring);
+        g_ring_state = 0;
+    }
+#endif
+    pthread_mutex_unlock (&g_mutex);
+}
+
+void
+synapticsmst_common_set_cancel_func (synapticsmst_cancel_func func, void *user_data)
+{
+    g_cancel_func = func;
+    g_cancel_data = user_data;
+}
+
+static int
+synapticsmst_common_is_cancelled (void)
+{
+    /* only stop between top level commands, never inside a tunnel */
+    if (g_remain_layer != g_layer) {
+        return 0;
+    }
+    if (g_cancel_func == NULL) {
+        return 0;
+    }
+    return g_cancel_func (g_cancel_data);
+}
+
+static int
+synapticsmst_common_rc_flags (int rc_cmd)
+{
+    if (rc_cmd < 0 || rc_cmd >= RC_OPCODES) {
+        return 0;
+    }
+    return g_rc_opcodes[rc_cmd].flags;
+}
+
+static unsigned char
+synapticsmst_common_rc_fixed (int rc_cmd, int length, int offset, unsigned char *data, unsigned char *reply);
+
+static unsigned char
+synapticsmst_common_rc_enable (void)
+{
+    unsigned char sc[] = { 'P', 'R', 'I', 'U', 'S' };
+
+    return synapticsmst_common_rc_fixed (UPDC_ENABLE_RC, sizeof (sc), 0, sc, NULL);
+}
+
+/* clear a command the hub will never finish and enter remote control again,
+ * so the next command at this depth doesn't inherit the hang; only used once
+ * the hub was seen to drop out of remote control */
+static void
+synapticsmst_common_rc_recover (void)
+{
+    static int recovering = 0;
+    int cmd = 0;
+
+    if (recovering) {
+        return;
+    }
+    recovering = 1;
+    g_stats.recoveries++;
+    g_mailbox.valid = 0;
+    synapticsmst_common_write_dpcd (REG_RC_CMD, &cmd, 1);
+    synapticsmst_common_rc_enable ();
+    recovering = 0;
+}
+
+/* sent is when the command went out, 0 for just now */
+static unsigned char
+synapticsmst_common_rc_wait_complete (int rc_cmd, long long sent, int *readData)
+{
+    unsigned char nRet;
+    unsigned char state[3];     /* REG_RC_STATE, REG_RC_CMD and REG_RC_RESULT */
+    int seen_enabled = 0;
+    int stuck_polls = 0;
+    struct timespec t_spec;
+    struct timespec t_poll = { 0, g_transport.poll_interval * 1000L };
+    fault_kind fault = synapticsmst_common_inject_rc ();
+    long long now;
+    long long deadline;
+    long long busy_until = 0;
+    long long wait_us = 0;
+
+    /* polling a command that can't have finished yet only costs AUX traffic */
+    if (synapticsmst_common_rc_flags (rc_cmd)) {
+        wait_us = g_rc_opcodes[rc_cmd].wait_time * 1000LL;
+    }
+    if (wait_us && sent) {
+        wait_us -= synapticsmst_common_get_time_us () - sent;
+    }
+    if (wait_us > 0) {
+        struct timespec t_wait = { wait_us / 1000000, (wait_us % 1000000) * 1000 };
+        nanosleep (&t_wait, NULL);
+    }
+
+    g_stats.rc_commands++;
+    clock_gettime (CLOCK_MONOTONIC, &t_spec);
+    now = t_spec.tv_sec * 1000LL + t_spec.tv_nsec / 1000000;
+    deadline = now + g_transport.max_wait_time;
+    if (fault == FAULT_DELAY) {
+        busy_until = now + g_faults.rc_delay_time;
+    }
+
+    do {
+        /* the state comes with the command in the same read */
+        nRet = synapticsmst_common_read_dpcd (REG_RC_STATE, (int *)state, 3);
+        if (nRet) {
+            break;
+        }
+        *readData = state[1] | (state[2] << 8);
+        if (fault == FAULT_STUCK) {
+            state[0] &= ~RC_STATE_ENABLED;
+        }
+        if (!(*readData & 0x80) && fault != FAULT_STUCK && now >= busy_until) {
+            /* trust the enabled bit at this depth only once a hub that just
+             * entered remote control has shown it */
+            if (rc_cmd == UPDC_ENABLE_RC && !(*readData & 0xFF00) && (state[0] & RC_STATE_ENABLED)) {
+                g_rc_state_known |= 1u << g_remain_layer;
+            }
+            break;
+        }
+
+        /* busy with remote control on is progress; a hub that dropped out of
+         * remote control after accepting the command will never finish it */
+        if (state[0] & RC_STATE_ENABLED) {
+            seen_enabled = 1;
+            stuck_polls = 0;
+        }
+        else if (((seen_enabled && (g_rc_state_known & (1u << g_remain_layer))) || fault == FAULT_STUCK) &&
+                 ++stuck_polls >= STUCK_POLLS) {
+            nRet = DPCD_STUCK;
+            break;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &t_spec);
+        now = t_spec.tv_sec * 1000LL + t_spec.tv_nsec / 1000000;
+        if (now > deadline) {
+            g_stats.timeouts++;
+            nRet = DPCD_TIMEOUT;
+            break;
+        }
+        /* give the hub time to work instead of hammering the AUX channel */
+        nanosleep (&t_poll, NULL);
+    } while (1);
+
+    /* a plain timeout may be a slow command or a probe of nothing, and
+     * either way remote control is still on */
+    if (nRet == DPCD_STUCK && !g_transport.no_recovery) {
+        synapticsmst_common_rc_recover ();
+    }
+    if (nRet) {
+        return nRet;
+    }
+    if (fault == FAULT_RC) {
+        return g_faults.rc_result;
+    }
+    if (*readData & 0xFF00) {
+        return (*readData >> 8) & 0xFF;
+    }
+    return DPCD_SUCCESS;
+}
+
+void
+synapticsmst_common_set_write_func (synapticsmst_write_func func, void *user_data)
+{
+    g_write_func = func;
+    g_write_data = user_data;
 }
 
 void
@@ -106,6 +778,14 @@ synapticsmst_common_config_connection (unsigned char layer, unsigned int RAD)
     g_RAD = RAD;
 }
 
+void
+synapticsmst_common_get_connection (const char **filename, unsigned char *layer, unsigned int *RAD)
+{
+    *filename = g_filename[0] != '\0' ? g_filename : NULL;
+    *layer = g_layer;
+    *RAD = g_RAD;
+}
+
 unsigned char
 synapticsmst_common_read_dpcd (int offset, int *buf, int length)
 {
@@ -140,260 +820,471 @@ synapticsmst_common_write_dpcd (int offset, int *buf, int length)
     }
 }
 
-unsigned char
-synapticsmst_common_rc_set_command (int rc_cmd, int length, int offset, unsigned char *buf)
+#ifdef HAVE_LIBURING
+static int
+synapticsmst_common_ring_ready (void)
 {
-    unsigned char nRet = 0;
-    int cur_offset = offset;
-    int cur_length;
-    int data_left = length;
-    int cmd;
-    int readData = 0;
-    long deadline;
-    struct timespec t_spec;
-
-    do{
-        if (data_left > UNIT_SIZE) {
-            cur_length = UNIT_SIZE;
+    if (g_ring_state == 0) {
+        if (getenv ("SYNAPTICSMST_NO_IO_URING") == NULL &&
+            io_uring_queue_init (RING_ENTRIES, &g_ring, 0) == 0) {
+            g_ring_state = 1;
         }
         else {
-            cur_length = data_left;
+            g_ring_state = -1;
         }
+    }
+    return g_ring_state > 0;
+}
 
-        if (cur_length) {
-            /* write data */
-            nRet = synapticsmst_common_write_dpcd (REG_RC_DATA, (int *)buf, cur_length);
-            if (nRet) {
-                break;
-            }
+/* submit the mailbox writes as one linked chain, so they still land in order
+ * but cost a single syscall instead of a seek and a write each */
+static unsigned char
+synapticsmst_common_ring_write_mailbox (int cmd, int length, int offset, unsigned char *data, int flags)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct {
+        int offset;
+        const void *buf;
+        int length;
+    } writes[4];
+    unsigned char nRet = DPCD_SUCCESS;
+    int bytes = 0;
+    int submitted;
+    int n = 0;
 
-            /* write offset */
-            nRet = synapticsmst_common_write_dpcd (REG_RC_OFFSET, &cur_offset, 4);
-            if (nRet) {
-                break;
-            }
+    if (flags & RC_SEND_DATA) {
+        writes[n].offset = REG_RC_DATA;
+        writes[n].buf = data;
+        writes[n++].length = length;
+    }
+    if (flags & RC_SEND_OFFSET) {
+        writes[n].offset = REG_RC_OFFSET;
+        writes[n].buf = &offset;
+        writes[n++].length = 4;
+    }
+    if (flags & RC_SEND_LEN) {
+        writes[n].offset = REG_RC_LEN;
+        writes[n].buf = &length;
+        writes[n++].length = 4;
+    }
+    writes[n].offset = REG_RC_CMD;
+    writes[n].buf = &cmd;
+    writes[n++].length = 1;
 
-            /* write length */
-            nRet = synapticsmst_common_write_dpcd (REG_RC_LEN, &cur_length, 4);
-            if (nRet) {
-                break;
-            }
-        }
+    /* the chain is still one AUX transaction per write */
+    for (int i = 0; i < n; i++) {
+        bytes += writes[i].length;
+    }
+    synapticsmst_common_throttle (n, bytes);
 
-        /* send command */
-        cmd = 0x80 | rc_cmd;
-        nRet = synapticsmst_common_write_dpcd (REG_RC_CMD, &cmd, 1);
-        if (nRet) {
-            break;
+    for (int i = 0; i < n; i++) {
+        sqe = io_uring_get_sqe (&g_ring);
+        io_uring_prep_write (sqe, g_fd, writes[i].buf, writes[i].length, writes[i].offset);
+        io_uring_sqe_set_data64 (sqe, i);
+        if (i < n - 1) {
+            sqe->flags |= IOSQE_IO_LINK;
         }
+    }
+    submitted = io_uring_submit_and_wait (&g_ring, n);
+    if (submitted != n) {
+        nRet = DPCD_ACCESS_FAIL;
+    }
 
-        /* wait command complete */
-        clock_gettime (CLOCK_REALTIME, &t_spec);
-        deadline = t_spec.tv_sec + MAX_WAIT_TIME;
+    /* a failed write cancels the rest of the chain, but every write that
+     * went in still posts a completion, and each one has to be reaped
+     * before the buffers on this stack go away */
+    for (int i = 0; i < submitted; i++) {
+        int ret;
 
         do {
-            nRet = synapticsmst_common_read_dpcd (REG_RC_CMD, &readData, 2);
-            clock_gettime (CLOCK_REALTIME, &t_spec);
-            if (t_spec.tv_sec > deadline) {
-                nRet = -1;
-            }
-        }while (nRet == 0 && readData & 0x80);
-
-        if (nRet) {
+            ret = io_uring_wait_cqe (&g_ring, &cqe);
+        } while (ret == -EINTR);
+        if (ret != 0) {
+            submitted = -1;
             break;
         }
-        else if (readData & 0xFF00) {
-            nRet = (readData >> 8) & 0xFF;
-            break;
+        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+            /* kernel without IORING_OP_WRITE, don't try again */
+            g_ring_state = -1;
+            nRet = DPCD_SEEK_FAIL;
         }
+        else if (cqe->res != writes[io_uring_cqe_get_data64 (cqe)].length && nRet == DPCD_SUCCESS) {
+            nRet = DPCD_ACCESS_FAIL;
+        }
+        io_uring_cqe_seen (&g_ring, cqe);
+    }
 
-        buf += cur_length;
-        cur_offset += cur_length;
-        data_left -= cur_length;
-    }while (data_left);
-
+    /* writes left in the submission queue, or completions that can't be
+     * reaped, would point at this stack on the next command */
+    if (submitted != n) {
+        g_ring_state = -1;
+        nRet = DPCD_ACCESS_FAIL;
+    }
+    if (g_ring_state < 0) {
+        io_uring_queue_exit (&g_ring);
+    }
     return nRet;
 }
+#endif
 
-unsigned char
-synapticsmst_common_rc_get_command (int rc_cmd, int length, int offset, unsigned char *buf)
+/* write the selected RC mailbox registers and start the command */
+static unsigned char
+synapticsmst_common_rc_send_regs (int rc_cmd, int length, int offset, unsigned char *data, int flags)
 {
-    unsigned char nRet = 0;
-    int cur_offset = offset;
-    int cur_length;
-    int data_need = length;
-    int cmd;
-    int readData = 0;
-    long deadline;
-    struct timespec t_spec;
+    unsigned char nRet;
+    int cmd = 0x80 | rc_cmd;
 
-    while (data_need) {
-        if (data_need > UNIT_SIZE) {
-            cur_length = UNIT_SIZE;
-        }
-        else {
-            cur_length = data_need;
+    /* tell the observer first, a failed write may still have landed */
+    if (g_write_func != NULL && (synapticsmst_common_rc_flags (rc_cmd) & RC_OP_EEPROM)) {
+        g_write_func (rc_cmd, offset, length, data, g_write_data);
+    }
+
+#ifdef HAVE_LIBURING
+    if (!(g_layer && g_remain_layer) && !g_emulated && synapticsmst_common_ring_ready ()) {
+        nRet = synapticsmst_common_ring_write_mailbox (cmd, length, offset, data, flags);
+        if (g_ring_state > 0 || nRet != DPCD_SEEK_FAIL) {
+            return nRet;
         }
+    }
+#endif
 
-        if (cur_length) {
-            /* write offset */
-            nRet = synapticsmst_common_write_dpcd (REG_RC_OFFSET, &cur_offset, 4);
-            if (nRet) {
-                break;
-            }
+    /* write data */
+    if (flags & RC_SEND_DATA) {
+        nRet = synapticsmst_common_write_dpcd (REG_RC_DATA, (int *)data, length);
+        if (nRet) {
+            return nRet;
+        }
+    }
 
-            /* write length */
-            nRet = synapticsmst_common_write_dpcd (REG_RC_LEN, &cur_length, 4);
-            if (nRet) {
-                break;
-            }
+    /* write offset */
+    if (flags & RC_SEND_OFFSET) {
+        nRet = synapticsmst_common_write_dpcd (REG_RC_OFFSET, &offset, 4);
+        if (nRet) {
+            return nRet;
         }
+    }
 
-        /* send command */
-        cmd = 0x80 | rc_cmd;
-        nRet = synapticsmst_common_write_dpcd (REG_RC_CMD, &cmd, 1);
+    /* write length */
+    if (flags & RC_SEND_LEN) {
+        nRet = synapticsmst_common_write_dpcd (REG_RC_LEN, &length, 4);
         if (nRet) {
-            break;
+            return nRet;
         }
+    }
 
-        /* wait command complete */
-        clock_gettime (CLOCK_REALTIME, &t_spec);
-        deadline = t_spec.tv_sec + MAX_WAIT_TIME;
+    return synapticsmst_common_write_dpcd (REG_RC_CMD, &cmd, 1);
+}
 
-        do {
-            nRet = synapticsmst_common_read_dpcd (REG_RC_CMD, &readData, 2);
-            clock_gettime (CLOCK_REALTIME, &t_spec);
-            if (t_spec.tv_sec > deadline) {
-                nRet = -1;
-            }
-        }while(nRet == 0 && readData & 0x80);
+static unsigned char
+synapticsmst_common_rc_send (int rc_cmd, int length, int offset, unsigned char *data)
+{
+    int flags = 0;
 
-        if (nRet) {
-            break;
+    /* anything outside a command list, tunnelling included, may move the
+     * mailbox registers of whichever hub it talks to */
+    g_mailbox.valid = 0;
+
+    if (length) {
+        flags = RC_SEND_OFFSET | RC_SEND_LEN;
+        if (data != NULL) {
+            flags |= RC_SEND_DATA;
         }
-        else if (readData & 0xFF00) {
-            nRet = (readData >> 8) & 0xFF;
+    }
+    return synapticsmst_common_rc_send_regs (rc_cmd, length, offset, data, flags);
+}
+
+/* send one command, wait for it and fetch its reply */
+static unsigned char
+synapticsmst_common_rc_once (int rc_cmd, int length, int offset, unsigned char *data, int reply_length, unsigned char *reply)
+{
+    unsigned char nRet;
+    int readData = 0;
+
+    nRet = synapticsmst_common_rc_send (rc_cmd, length, offset, data);
+    if (nRet) {
+        return nRet;
+    }
+    nRet = synapticsmst_common_rc_wait_complete (rc_cmd, 0, &readData);
+    if (nRet) {
+        return nRet;
+    }
+    if (reply_length && reply != NULL) {
+        nRet = synapticsmst_common_read_dpcd (REG_RC_DATA, (int *)reply, reply_length);
+    }
+    return nRet;
+}
+
+/* fixed shape commands are one exchange of the sizes in g_rc_opcodes, with
+ * nothing to split and nothing to allocate */
+static unsigned char
+synapticsmst_common_rc_fixed (int rc_cmd, int length, int offset, unsigned char *data, unsigned char *reply)
+{
+    int flags = synapticsmst_common_rc_flags (rc_cmd);
+
+    if (!(flags & RC_OP_FIXED) ||
+        ((flags & RC_OP_DATA) && (data == NULL || length != g_rc_opcodes[rc_cmd].data_length))) {
+        return UPDC_COMMAND_INVALID;
+    }
+    if (synapticsmst_common_is_cancelled ()) {
+        return DPCD_CANCELLED;
+    }
+    return synapticsmst_common_rc_once (rc_cmd, length, offset, (flags & RC_OP_DATA) ? data : NULL,
+                                        g_rc_opcodes[rc_cmd].reply_length, reply);
+}
+
+/* move a range through REG_RC_DATA in unit_size chunks, sending buf with
+ * each chunk when writing or reading each chunk back into buf */
+static unsigned char
+synapticsmst_common_rc_bulk (int rc_cmd, int write, int length, int offset, unsigned char *buf)
+{
+    unsigned char nRet = 0;
+    int cur_length;
+
+    /* a write without data is still one command */
+    if (!write && length == 0) {
+        return DPCD_SUCCESS;
+    }
+
+    do {
+        if (synapticsmst_common_is_cancelled ()) {
+            nRet = DPCD_CANCELLED;
             break;
         }
 
-        if (cur_length) {
-            nRet = synapticsmst_common_read_dpcd (REG_RC_DATA, (int *)buf, cur_length);
-            if (nRet) {
-                break;
-            }
+        cur_length = length > g_transport.unit_size ? g_transport.unit_size : length;
+        nRet = synapticsmst_common_rc_once (rc_cmd, cur_length, offset, write ? buf : NULL, write ? 0 : cur_length, buf);
+        if (nRet) {
+            break;
         }
 
         buf += cur_length;
-        cur_offset += cur_length;
-        data_need -= cur_length;
-    }
+        offset += cur_length;
+        length -= cur_length;
+    } while (length);
 
     return nRet;
 }
 
+unsigned char
+synapticsmst_common_rc_set_command (int rc_cmd, int length, int offset, unsigned char *buf)
+{
+    if (synapticsmst_common_rc_flags (rc_cmd) & RC_OP_FIXED) {
+        return synapticsmst_common_rc_fixed (rc_cmd, length, offset, buf, NULL);
+    }
+    return synapticsmst_common_rc_bulk (rc_cmd, 1, length, offset, buf);
+}
+
+unsigned char
+synapticsmst_common_rc_get_command (int rc_cmd, int length, int offset, unsigned char *buf)
+{
+    return synapticsmst_common_rc_bulk (rc_cmd, 0, length, offset, buf);
+}
+
 unsigned char
 synapticsmst_common_rc_special_get_command (int rc_cmd, int cmd_length, int cmd_offset, unsigned char *cmd_data, int length, unsigned char *buf)
 {
-    unsigned char nRet = 0;
+    if (synapticsmst_common_is_cancelled ()) {
+        return DPCD_CANCELLED;
+    }
+    return synapticsmst_common_rc_once (rc_cmd, cmd_length, cmd_offset, cmd_data, length, buf);
+}
+
+unsigned char
+synapticsmst_common_rc_get_checksum (int rc_cmd, int length, int offset, unsigned int *checksum)
+{
+    unsigned char reply[4];
+    unsigned char nRet;
+
+    if (!(synapticsmst_common_rc_flags (rc_cmd) & RC_OP_REPLY) || g_rc_opcodes[rc_cmd].reply_length != sizeof (reply)) {
+        return UPDC_COMMAND_INVALID;
+    }
+    nRet = synapticsmst_common_rc_fixed (rc_cmd, length, offset, NULL, reply);
+    if (nRet) {
+        return nRet;
+    }
+    *checksum = reply[0] | (reply[1] << 8) | (reply[2] << 16) | ((unsigned int) reply[3] << 24);
+    return DPCD_SUCCESS;
+}
+
+unsigned char
+synapticsmst_common_rc_start_command (int rc_cmd, int length, int offset, unsigned char *buf)
+{
+    unsigned char nRet;
+
+    /* only single chunk commands can be left running */
+    if (length > UNIT_SIZE) {
+        return UPDC_COMMAND_INVALID;
+    }
+
+    if (synapticsmst_common_is_cancelled ()) {
+        return DPCD_CANCELLED;
+    }
+
+    /* send command and return without waiting */
+    nRet = synapticsmst_common_rc_send (rc_cmd, length, offset, buf);
+    if (nRet == DPCD_SUCCESS) {
+        g_rc_started = rc_cmd;
+        g_rc_started_at = synapticsmst_common_get_time_us ();
+    }
+    return nRet;
+}
+
+unsigned char
+synapticsmst_common_rc_wait_command (void)
+{
     int readData = 0;
-    int cmd;
-    long deadline;
-    struct timespec t_spec;
+    int rc_cmd = g_rc_started;
+    long long sent = g_rc_started_at;
 
-    do {
-        if (cmd_length) {
-            /* write cmd data */
-            if (cmd_data != NULL) {
-                nRet = synapticsmst_common_write_dpcd (REG_RC_DATA, (int *)cmd_data, cmd_length);
-                if (nRet) {
-                    break;
-                }
-            }
+    /* the command is only waited for once */
+    g_rc_started = 0;
+    g_rc_started_at = 0;
+    return synapticsmst_common_rc_wait_complete (rc_cmd, sent, &readData);
+}
 
-            /* write offset */
-            nRet = synapticsmst_common_write_dpcd (REG_RC_OFFSET, &cmd_offset, 4);
-            if (nRet) {
-                break;
-            }
+int
+synapticsmst_common_rc_run_list (synapticsmst_rc_op *ops, int n_ops)
+{
+    unsigned char sc[] = { 'P', 'R', 'I', 'U', 'S' };
+    int readData = 0;
+    int i;
+
+    for (i = 0; i < n_ops; i++) {
+        ops[i].result = DPCD_SKIPPED;
+    }
+
+    for (i = 0; i < n_ops; i++) {
+        synapticsmst_rc_op *op = &ops[i];
+        unsigned char *data = op->data;
+        int length = op->length;
+        int flags = 0;
+        int kept;
 
-            /* write length */
-            nRet = synapticsmst_common_write_dpcd (REG_RC_LEN, &cmd_length, 4);
-            if (nRet) {
+        /* entering remote control takes the mailbox for this process, the
+         * same as synapticsmst_common_enable_remote_control_layer() */
+        if (op->rc_cmd == UPDC_ENABLE_RC) {
+            if (data == NULL) {
+                data = sc;
+                length = sizeof (sc);
+            }
+            op->result = synapticsmst_common_lock_aux_node (1);
+            if (op->result) {
                 break;
             }
         }
-
-        /* send command */
-        cmd = 0x80 | rc_cmd;
-        nRet = synapticsmst_common_write_dpcd (REG_RC_CMD, &cmd, 1);
-        if (nRet) {
+        if ((data != NULL && length > g_transport.unit_size) ||
+            op->read_length > g_transport.unit_size) {
+            op->result = UPDC_COMMAND_INVALID;
+            break;
+        }
+        if (synapticsmst_common_is_cancelled ()) {
+            op->result = DPCD_CANCELLED;
             break;
         }
 
-        /* wait command complete */
-        clock_gettime (CLOCK_REALTIME, &t_spec);
-        deadline = t_spec.tv_sec + MAX_WAIT_TIME;
-
-        do {
-            nRet = synapticsmst_common_read_dpcd (REG_RC_CMD, &readData, 2);
-            clock_gettime (CLOCK_REALTIME, &t_spec);
-            if (t_spec.tv_sec > deadline) {
-                nRet = -1;
+        /* the registers keep their values between commands, so only write
+         * what differs from what a list last wrote on this hub */
+        kept = g_mailbox.valid && g_mailbox.layer == g_layer && g_mailbox.RAD == g_RAD;
+        if (length) {
+            if (data != NULL) {
+                flags |= RC_SEND_DATA;
+            }
+            if (!kept || g_mailbox.offset != op->offset) {
+                flags |= RC_SEND_OFFSET;
+            }
+            if (!kept || g_mailbox.length != length) {
+                flags |= RC_SEND_LEN;
             }
-        }while (nRet == 0 && readData & 0x80);
+        }
 
-        if (nRet) {
-            break;
+        /* a failed write may have landed, and entering or leaving remote
+         * control may reset the mailbox */
+        g_mailbox.valid = 0;
+        op->result = synapticsmst_common_rc_send_regs (op->rc_cmd, length, op->offset, data, flags);
+        if (op->result == DPCD_SUCCESS) {
+            op->result = synapticsmst_common_rc_wait_complete (op->rc_cmd, 0, &readData);
         }
-        else if (readData & 0xFF00) {
-            nRet = (readData >> 8) & 0xFF;
+        if (op->result == DPCD_SUCCESS && op->read_length) {
+            op->result = synapticsmst_common_read_dpcd (REG_RC_DATA, (int *)op->buf, op->read_length);
+        }
+        if (op->result) {
             break;
         }
-
+        if (op->rc_cmd == UPDC_ENABLE_RC || op->rc_cmd == UPDC_DISABLE_RC) {
+            continue;
+        }
         if (length) {
-            nRet = synapticsmst_common_read_dpcd (REG_RC_DATA, (int *)buf, length);
-            if (nRet) {
-                break;
-            }
+            g_mailbox.layer = g_layer;
+            g_mailbox.RAD = g_RAD;
+            g_mailbox.offset = op->offset;
+            g_mailbox.length = length;
+            g_mailbox.valid = 1;
         }
-    } while (0);
+        else {
+            g_mailbox.valid = kept;
+        }
+    }
+
+    return i;
+}
 
+unsigned char
+synapticsmst_common_enable_remote_control_layer (unsigned char layer)
+{
+    unsigned char tmp_layer = g_layer;
+    unsigned char nRet;
+
+    /* the RC mailbox is a single register set, so RC users are exclusive */
+    nRet = synapticsmst_common_lock_aux_node (1);
+    if (nRet) {
+        return nRet;
+    }
+
+    synapticsmst_common_config_connection (layer, g_RAD);
+    nRet = synapticsmst_common_rc_enable ();
+    synapticsmst_common_config_connection (tmp_layer, g_RAD);
     return nRet;
 }
 
 unsigned char
-synapticsmst_common_enable_remote_control (void)
+synapticsmst_common_disable_remote_control_layer (unsigned char layer)
 {
-    const char *sc = "PRIUS";
     unsigned char tmp_layer = g_layer;
+    unsigned char nRet;
+
+    synapticsmst_common_config_connection (layer, g_RAD);
+    nRet = synapticsmst_common_rc_fixed (UPDC_DISABLE_RC, 0, 0, NULL, NULL);
+    synapticsmst_common_config_connection (tmp_layer, g_RAD);
+    return nRet;
+}
+
+unsigned char
+synapticsmst_common_enable_remote_control (void)
+{
     unsigned char nRet = 0;
 
-    for (int i=0; i<=tmp_layer; i++) {
-        synapticsmst_common_config_connection (i, g_RAD);
-        nRet = synapticsmst_common_rc_set_command (UPDC_ENABLE_RC, 5, 0, (unsigned char*)sc);
+    for (int i=0; i<=g_layer; i++) {
+        nRet = synapticsmst_common_enable_remote_control_layer (i);
         if (nRet) {
             break;
         }
     }
 
-    synapticsmst_common_config_connection (tmp_layer, g_RAD);
     return nRet;
 }
 
 unsigned char
 synapticsmst_common_disable_remote_control (void)
 {
-    unsigned char tmp_layer = g_layer;
     unsigned char nRet = 0;
 
-    for (int i=tmp_layer; i>=0; i--) {
-        synapticsmst_common_config_connection (i, g_RAD);
-        nRet = synapticsmst_common_rc_set_command (UPDC_DISABLE_RC, 0, 0, (unsigned char*)NULL);
+    for (int i=g_layer; i>=0; i--) {
+        nRet = synapticsmst_common_disable_remote_control_layer (i);
         if (nRet) {
             break;
         }
     }
 
-    synapticsmst_common_config_connection (tmp_layer, g_RAD);
     return nRet;
-}
\ No newline at end of file
+}
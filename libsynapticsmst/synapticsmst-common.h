@@ -27,6 +27,11 @@
 #define ADDR_CUSTOMER_ID        0X10E
 #define ADDR_BOARD_ID           0x10F
 
+#define REG_MSTM_CAP            0x21
+#define REG_GUID                0x30
+#define GUID_SIZE               16
+#define REG_MSTM_CTRL           0x111
+
 #define REG_RC_CAP              0x4B0
 #define REG_RC_STATE            0X4B1
 #define REG_RC_CMD              0x4B2
@@ -39,10 +44,25 @@
 #define REG_CHIP_ID             0x507
 #define REG_FIRMWARE_VERSIOIN   0x50A
 
+#define REG_SIDEBAND_DOWN_REQ   0x1000
+#define REG_SIDEBAND_DOWN_REP   0x1400
+#define REG_ESI0                0x2003
+
+/* vendor ID, chip ID and firmware version are read as one block */
+#define IDENTITY_BLOCK_SIZE     (REG_FIRMWARE_VERSIOIN + 3 - REG_VENDOR_ID)
+
+/* DPCD addresses are 20 bits */
+#define DPCD_ADDRESS_SPACE      0x100000
+
 typedef enum {
     DPCD_SUCCESS = 0,
     DPCD_SEEK_FAIL,
     DPCD_ACCESS_FAIL,
+    DPCD_STUCK = 0xFB,      /* the hub left remote control mid-command, recovered unless no_recovery */
+    DPCD_SKIPPED = 0xFC,
+    DPCD_BUSY = 0xFD,
+    DPCD_CANCELLED = 0xFE,
+    DPCD_TIMEOUT = 0xFF,
 }dpcd_return;
 
 typedef enum {
@@ -64,20 +84,119 @@ typedef enum {
     UPDC_CAL_EEPROM_CHECK_CRC8 = 0X16,
     UPDC_CAL_EEPROM_CHECK_CRC16,
     UPDC_WRITE_TO_EEPROM = 0X20,
+    UPDC_WRITE_TO_MEMORY = 0x21,
     UPDC_WRITE_TO_TX_DPCD = 0x22,
     UPDC_READ_FROM_EEPROM = 0x30,
     UPDC_READ_FROM_TX_DPCD = 0x32,
 }RC_COMMAND;
 
+typedef int (*synapticsmst_cancel_func)(void *user_data);
+
+/* called before any RC command that may change the EEPROM is sent on the
+ * current connection; data holds the command parameters, e.g. the erase code */
+typedef void (*synapticsmst_write_func)(int rc_cmd, int offset, int length, const unsigned char *data, void *user_data);
+
+/* tunable per board, reset to the defaults when the aux node is closed */
+typedef struct {
+    int unit_size;      /* bytes per RC transfer, at most 32 */
+    int max_wait_time;  /* unit : millisecond */
+    int poll_interval;  /* unit : microsecond */
+    int no_recovery;    /* leave stuck commands alone, for probes expected to fail */
+}synapticsmst_transport;
+
+/* one step of synapticsmst_common_rc_run_list() */
+typedef struct {
+    int rc_cmd;
+    int length;             /* written to REG_RC_LEN, and the size of data */
+    int offset;             /* written to REG_RC_OFFSET */
+    unsigned char *data;    /* written to REG_RC_DATA first, or NULL */
+    int read_length;        /* bytes read back from REG_RC_DATA into buf */
+    unsigned char *buf;
+    unsigned char result;   /* dpcd_return or RC_STATUS, DPCD_SKIPPED if not run */
+}synapticsmst_rc_op;
+
+/* running totals for this process, tunnelled commands included */
+typedef struct {
+    unsigned int rc_commands;
+    unsigned int timeouts;
+    unsigned int recoveries;     /* stuck or timed out commands cleared in-band */
+    unsigned long throttled_us;  /* time spent waiting for the AUX budget */
+}synapticsmst_stats;
+
+/* AUX budgets apply per traffic class; the class goes back to background
+ * when the aux node is closed */
+typedef enum {
+    TRAFFIC_BACKGROUND = 0,     /* enumeration, inventory and audit */
+    TRAFFIC_FOREGROUND,         /* flashing and anything timing it */
+    TRAFFIC_CLASSES,
+}synapticsmst_traffic;
+
+/* 0 for unlimited */
+typedef struct {
+    int transactions;   /* AUX transactions per second */
+    int bytes;          /* AUX bytes per second */
+}synapticsmst_budget;
+
+/* deterministic fault injection for testing, rates are per mille; only
+ * applied while talking to the emulator */
+typedef struct {
+    unsigned int seed;
+    int aux_latency;        /* added to every AUX access, unit : microsecond */
+    int aux_fail;           /* AUX accesses failing with DPCD_ACCESS_FAIL */
+    int rc_fail;            /* RC commands completing with rc_result */
+    int rc_result;
+    int rc_delay;           /* RC commands staying busy for rc_delay_time */
+    int rc_delay_time;      /* unit : millisecond */
+    int rc_stuck;           /* RC commands never completing */
+    const char *script;     /* fixed faults, e.g. "aux@12,rc@40,delay@7,stuck@90" */
+}synapticsmst_faults;
+
+/* returns 1 for a Synaptics MST hub, 0 for any other device, -1 if the node
+ * can't be opened, with errno set by open(), and -2 if another process kept
+ * it locked for too long */
 int
 synapticsmst_common_open_aux_node(const char* filename);
 
+void
+synapticsmst_common_set_transport(const synapticsmst_transport *transport);
+
+void
+synapticsmst_common_get_transport(synapticsmst_transport *transport);
+
+void
+synapticsmst_common_get_stats(synapticsmst_stats *stats);
+
+void
+synapticsmst_common_set_budget(synapticsmst_traffic traffic, const synapticsmst_budget *budget);
+
+void
+synapticsmst_common_set_traffic(synapticsmst_traffic traffic);
+
+void
+synapticsmst_common_set_faults(const synapticsmst_faults *faults);
+
+void
+synapticsmst_common_set_lock_timeout(int timeout_ms);
+
+unsigned char
+synapticsmst_common_lock_aux_node(int exclusive);
+
 void
 synapticsmst_common_close_aux_node(void);
 
+void
+synapticsmst_common_set_cancel_func(synapticsmst_cancel_func func, void *user_data);
+
+void
+synapticsmst_common_set_write_func(synapticsmst_write_func func, void *user_data);
+
 void
 synapticsmst_common_config_connection(unsigned char layer, unsigned int RAD);
 
+/* filename is NULL while no aux node is open */
+void
+synapticsmst_common_get_connection(const char **filename, unsigned char *layer, unsigned int *RAD);
+
 unsigned char
 synapticsmst_common_read_dpcd(int offset, int *buf, int length);
 
@@ -93,6 +212,29 @@ synapticsmst_common_rc_get_command(int rc_cmd, int length, int offset, unsigned
 unsigned char
 synapticsmst_common_rc_special_get_command(int rc_cmd, int cmd_length, int cmd_offset, unsigned char *cmd_data, int length, unsigned char *buf);
 
+/* for the CAL_EEPROM_CHECK* commands, which answer with 4 bytes */
+unsigned char
+synapticsmst_common_rc_get_checksum(int rc_cmd, int length, int offset, unsigned int *checksum);
+
+unsigned char
+synapticsmst_common_rc_start_command(int rc_cmd, int length, int offset, unsigned char *buf);
+
+unsigned char
+synapticsmst_common_rc_wait_command(void);
+
+/* runs the ops in order and stops at the first failure; returns the number
+ * of ops that succeeded. OFFSET and LEN are only written when they differ
+ * from what a list last wrote on the same hub, and UPDC_ENABLE_RC may
+ * leave data NULL for the usual unlock code */
+int
+synapticsmst_common_rc_run_list(synapticsmst_rc_op *ops, int n_ops);
+
+unsigned char
+synapticsmst_common_enable_remote_control_layer(unsigned char layer);
+
+unsigned char
+synapticsmst_common_disable_remote_control_layer(unsigned char layer);
+
 unsigned char
 synapticsmst_common_enable_remote_control(void);
 
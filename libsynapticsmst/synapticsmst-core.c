@@ -0,0 +1,938 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "synapticsmst-common.h"
+#include "synapticsmst-core.h"
+
+#define CRC16_POLYNOMIAL        0x8005
+#define PROBE_WAIT_TIME         100  /* unit : millisecond per layer, for a port that may be empty */
+#define SIDEBAND_MSG_SIZE       48   /* one chunk of a sideband message */
+#define SIDEBAND_REPLY_SIZE     256
+#define SIDEBAND_LINK_ADDRESS   0x01
+#define PEER_MST_BRANCH         2
+#define ESI0_DOWN_REP_MSG_RDY   0x10
+#define BLOCK_UNIT_DEFAULT      64
+#define CACHE_ENTRIES           8
+#define CACHE_BLOCK_SIZE        64
+#define CACHE_BLOCK_MIN         16
+
+typedef struct {
+    char filename[256];
+    unsigned char layer;
+    unsigned int RAD;
+    synapticsmst_identity identity;
+    unsigned int last_used;     /* 0 for a free entry */
+    unsigned char valid[CACHE_SIZE / CACHE_BLOCK_MIN];
+    unsigned char data[CACHE_SIZE];
+}cache_entry;
+
+/* cache_lookup runs without the aux node open, so the cache can't rely on
+ * the connection lock in synapticsmst-common.c */
+static pthread_mutex_t g_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry g_cache[CACHE_ENTRIES];
+static unsigned int g_cache_clock = 0;
+static int g_cache_block_size = CACHE_BLOCK_SIZE;
+static int g_cache_hooked = 0;
+
+static int
+synapticsmst_core_image_check_region (const unsigned char *data, int offset, int length)
+{
+    unsigned char checksum = 0;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        checksum += data[offset + i];
+    }
+    return checksum == 0;
+}
+
+unsigned short
+synapticsmst_core_image_get_board_id (const unsigned char *data, int length)
+{
+    if (length <= ADDR_BOARD_ID) {
+        return 0xFFFF;
+    }
+    return (data[ADDR_CUSTOMER_ID] << 8) + data[ADDR_BOARD_ID];
+}
+
+/* same algorithm as UPDC_CAL_EEPROM_CHECK_CRC16 */
+unsigned short
+synapticsmst_core_image_crc16 (unsigned short crc, const unsigned char *data, int length)
+{
+    int i, j;
+
+    for (i = 0; i < length; i++) {
+        crc ^= (unsigned short) data[i] << 8;
+        for (j = 0; j < 8; j++) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ CRC16_POLYNOMIAL;
+            }
+            else {
+                crc <<= 1;
+            }
+        }
+    }
+    return crc;
+}
+
+/* same algorithm as UPDC_CAL_EEPROM_CHECKSUM */
+unsigned int
+synapticsmst_core_image_checksum (const unsigned char *data, int length)
+{
+    unsigned int checksum = 0;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        checksum += data[i];
+    }
+    return checksum;
+}
+
+synapticsmst_image_status
+synapticsmst_core_image_validate (const unsigned char *data, int length)
+{
+    int code_size;
+
+    if (length > IMAGE_MAX_SIZE || length < IMAGE_CODE_OFFSET + 2) {
+        return IMAGE_INVALID_SIZE;
+    }
+
+    /* two EDID blocks */
+    if (!synapticsmst_core_image_check_region (data, 0, 128) ||
+        !synapticsmst_core_image_check_region (data, 128, 128)) {
+        return IMAGE_EDID_CHECKSUM;
+    }
+
+    /* two configuration blocks */
+    if (!synapticsmst_core_image_check_region (data, 0x100, 256) ||
+        !synapticsmst_core_image_check_region (data, 0x200, 256)) {
+        return IMAGE_CONFIG_CHECKSUM;
+    }
+
+    /* firmware code, with its own size header */
+    code_size = (data[IMAGE_CODE_OFFSET] << 8) + data[IMAGE_CODE_OFFSET + 1];
+    if (code_size >= 0xFFFF || IMAGE_CODE_OFFSET + code_size + 17 > length) {
+        return IMAGE_FIRMWARE_SIZE;
+    }
+    if (!synapticsmst_core_image_check_region (data, IMAGE_CODE_OFFSET, code_size + 17)) {
+        return IMAGE_FIRMWARE_CHECKSUM;
+    }
+    return IMAGE_VALID;
+}
+
+static synapticsmst_image_status
+synapticsmst_core_region_validate (synapticsmst_region region, const unsigned char *data, int length)
+{
+    int code_size;
+
+    switch (region) {
+    case REGION_EDID:
+        if (length != 0x100) {
+            return IMAGE_INVALID_SIZE;
+        }
+        if (!synapticsmst_core_image_check_region (data, 0, 128) ||
+            !synapticsmst_core_image_check_region (data, 128, 128)) {
+            return IMAGE_EDID_CHECKSUM;
+        }
+        return IMAGE_VALID;
+    case REGION_CONFIG:
+        if (length != 0x200) {
+            return IMAGE_INVALID_SIZE;
+        }
+        if (!synapticsmst_core_image_check_region (data, 0, 256) ||
+            !synapticsmst_core_image_check_region (data, 256, 256)) {
+            return IMAGE_CONFIG_CHECKSUM;
+        }
+        return IMAGE_VALID;
+    case REGION_CODE:
+        if (length < 2) {
+            return IMAGE_INVALID_SIZE;
+        }
+        code_size = (data[0] << 8) + data[1];
+        if (code_size >= 0xFFFF || code_size + 17 != length || IMAGE_CODE_OFFSET + length > IMAGE_MAX_SIZE) {
+            return IMAGE_FIRMWARE_SIZE;
+        }
+        if (!synapticsmst_core_image_check_region (data, 0, length)) {
+            return IMAGE_FIRMWARE_CHECKSUM;
+        }
+        return IMAGE_VALID;
+    case REGION_LAST:
+        break;
+    }
+    return IMAGE_INVALID_SIZE;
+}
+
+synapticsmst_image_status
+synapticsmst_core_image_get_region (synapticsmst_region region, const unsigned char *data, int length,
+                                    const unsigned char **region_data, int *offset, int *region_length)
+{
+    const int offsets[] = { 0, 0x100, IMAGE_CODE_OFFSET };
+    const int sizes[] = { 0x100, 0x200, 0 };
+    synapticsmst_image_status status;
+    int size;
+
+    if (region >= REGION_LAST) {
+        return IMAGE_INVALID_SIZE;
+    }
+
+    /* a region on its own has exactly its size, as written in the header
+     * for code; anything else has to be a whole image */
+    size = sizes[region];
+    if (region == REGION_CODE && length >= 2) {
+        size = (data[0] << 8) + data[1] + 17;
+    }
+    if (length != size) {
+        status = synapticsmst_core_image_validate (data, length);
+        if (status != IMAGE_VALID) {
+            return status;
+        }
+        data += offsets[region];
+        size = region == REGION_CODE ? (data[0] << 8) + data[1] + 17 : sizes[region];
+    }
+
+    status = synapticsmst_core_region_validate (region, data, size);
+    if (status == IMAGE_VALID) {
+        *region_data = data;
+        *offset = offsets[region];
+        *region_length = size;
+    }
+    return status;
+}
+
+const char *
+synapticsmst_core_image_status_to_string (synapticsmst_image_status status)
+{
+    switch (status) {
+    case IMAGE_VALID:
+        return "valid";
+    case IMAGE_INVALID_SIZE:
+        return "invalid file size";
+    case IMAGE_EDID_CHECKSUM:
+        return "EDID checksum error";
+    case IMAGE_CONFIG_CHECKSUM:
+        return "configuration checksum error";
+    case IMAGE_FIRMWARE_SIZE:
+        return "invalid firmware size";
+    case IMAGE_FIRMWARE_CHECKSUM:
+        return "firmware checksum error";
+    }
+    return "unknown error";
+}
+
+unsigned char
+synapticsmst_core_read_identity (synapticsmst_identity *identity)
+{
+    unsigned char byte[IDENTITY_BLOCK_SIZE];
+    unsigned char nRet;
+    int blank = 1;
+    int i;
+
+    /* vendor ID, chip ID and firmware version in one read */
+    nRet = synapticsmst_common_read_dpcd (REG_VENDOR_ID, (int *)byte, IDENTITY_BLOCK_SIZE);
+    if (nRet) {
+        return nRet;
+    }
+    memcpy (identity->vendor_id, byte, 3);
+    memcpy (identity->chip_id, byte + (REG_CHIP_ID - REG_VENDOR_ID), 2);
+    memcpy (identity->version, byte + (REG_FIRMWARE_VERSIOIN - REG_VENDOR_ID), 3);
+
+    /* the branch GUID tells one hub apart from its twin on another dock,
+     * but is optional and left blank by some firmware */
+    identity->has_guid = 0;
+    if (synapticsmst_common_read_dpcd (REG_GUID, (int *)identity->guid, GUID_SIZE) == DPCD_SUCCESS) {
+        for (i = 1; i < GUID_SIZE; i++) {
+            if (identity->guid[i] != identity->guid[0]) {
+                blank = 0;
+                break;
+            }
+        }
+        if (!blank || (identity->guid[0] != 0x00 && identity->guid[0] != 0xFF)) {
+            identity->has_guid = 1;
+        }
+    }
+    return DPCD_SUCCESS;
+}
+
+static int
+synapticsmst_core_cache_match (const cache_entry *entry, const char *filename, unsigned char layer, unsigned int RAD)
+{
+    return entry->last_used != 0 && entry->layer == layer && entry->RAD == RAD &&
+           strcmp (entry->filename, filename) == 0;
+}
+
+static int
+synapticsmst_core_identity_equal (const synapticsmst_identity *identity1, const synapticsmst_identity *identity2)
+{
+    return memcmp (identity1->vendor_id, identity2->vendor_id, sizeof (identity1->vendor_id)) == 0 &&
+           memcmp (identity1->chip_id, identity2->chip_id, sizeof (identity1->chip_id)) == 0 &&
+           memcmp (identity1->version, identity2->version, sizeof (identity1->version)) == 0 &&
+           identity1->has_guid == identity2->has_guid &&
+           (!identity1->has_guid || memcmp (identity1->guid, identity2->guid, GUID_SIZE) == 0);
+}
+
+static cache_entry *
+synapticsmst_core_cache_find (const char *filename, unsigned char layer, unsigned int RAD, const synapticsmst_identity *identity)
+{
+    int i;
+
+    for (i = 0; i < CACHE_ENTRIES; i++) {
+        if (synapticsmst_core_cache_match (&g_cache[i], filename, layer, RAD) &&
+            synapticsmst_core_identity_equal (&g_cache[i].identity, identity)) {
+            return &g_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* drop the cached blocks overlapping an EEPROM write on this connection; a
+ * hub answering with a new identity gets a fresh entry anyway */
+static void
+synapticsmst_core_cache_write_cb (int rc_cmd, int offset, int length, const unsigned char *data, void *user_data)
+{
+    const char *filename;
+    unsigned char layer;
+    unsigned int RAD;
+    int first = 0;
+    int last = CACHE_SIZE / CACHE_BLOCK_MIN - 1;
+    int i, j;
+
+    synapticsmst_common_get_connection (&filename, &layer, &RAD);
+    if (filename == NULL) {
+        return;
+    }
+    pthread_mutex_lock (&g_cache_mutex);
+    if (g_cache_block_size == 0) {
+        goto out;
+    }
+    if (rc_cmd == UPDC_WRITE_TO_EEPROM) {
+        if (offset >= CACHE_SIZE || length <= 0) {
+            goto out;
+        }
+        first = offset / g_cache_block_size;
+        last = (offset + length - 1) / g_cache_block_size;
+    }
+    else if (rc_cmd == UPDC_FLASH_ERASE && data != NULL && ((data[1] << 8) & 0xF000) == SECTOR_ERASE_4K) {
+        offset = ((data[0] | (data[1] << 8)) - SECTOR_ERASE_4K) * SECTOR_SIZE;
+        if (offset >= CACHE_SIZE) {
+            goto out;
+        }
+        first = offset / g_cache_block_size;
+        last = (offset + SECTOR_SIZE - 1) / g_cache_block_size;
+    }
+    for (i = 0; i < CACHE_ENTRIES; i++) {
+        if (synapticsmst_core_cache_match (&g_cache[i], filename, layer, RAD)) {
+            for (j = first; j <= last && j < CACHE_SIZE / CACHE_BLOCK_MIN; j++) {
+                g_cache[i].valid[j] = 0;
+            }
+        }
+    }
+out:
+    pthread_mutex_unlock (&g_cache_mutex);
+}
+
+void
+synapticsmst_core_set_cache_block_size (int block_size)
+{
+    int size = CACHE_BLOCK_MIN;
+
+    if (block_size > 0) {
+        /* whole blocks must tile the cached region */
+        while (size * 2 <= block_size && size * 2 <= CACHE_SIZE) {
+            size *= 2;
+        }
+    }
+    else {
+        size = 0;
+    }
+    pthread_mutex_lock (&g_cache_mutex);
+    if (size != g_cache_block_size) {
+        memset (g_cache, 0, sizeof (g_cache));
+        g_cache_block_size = size;
+    }
+    pthread_mutex_unlock (&g_cache_mutex);
+}
+
+int
+synapticsmst_core_cache_lookup (const char *filename, unsigned char layer, unsigned int RAD, const synapticsmst_identity *identity, int offset, int length, unsigned char *buf)
+{
+    cache_entry *entry;
+    int found = 0;
+    int i;
+
+    if (filename == NULL || identity == NULL || offset < 0 || length <= 0 || offset + length > CACHE_SIZE) {
+        return 0;
+    }
+    pthread_mutex_lock (&g_cache_mutex);
+    if (g_cache_block_size == 0) {
+        goto out;
+    }
+    entry = synapticsmst_core_cache_find (filename, layer, RAD, identity);
+    if (entry == NULL) {
+        goto out;
+    }
+    for (i = offset / g_cache_block_size; i <= (offset + length - 1) / g_cache_block_size; i++) {
+        if (!entry->valid[i]) {
+            goto out;
+        }
+    }
+    memcpy (buf, entry->data + offset, length);
+    entry->last_used = ++g_cache_clock;
+    found = 1;
+out:
+    pthread_mutex_unlock (&g_cache_mutex);
+    return found;
+}
+
+unsigned char
+synapticsmst_core_read_eeprom (const synapticsmst_identity *identity, int offset, int length, unsigned char *buf)
+{
+    cache_entry *entry;
+    const char *filename;
+    unsigned char layer;
+    unsigned int RAD;
+    unsigned char nRet = DPCD_SUCCESS;
+    int i;
+
+    synapticsmst_common_get_connection (&filename, &layer, &RAD);
+    if (filename == NULL || identity == NULL || offset < 0 || length <= 0 || offset + length > CACHE_SIZE) {
+        return synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, length, offset, buf);
+    }
+
+    /* held over the reads too, they never call back into the cache */
+    pthread_mutex_lock (&g_cache_mutex);
+    if (g_cache_block_size == 0) {
+        pthread_mutex_unlock (&g_cache_mutex);
+        return synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, length, offset, buf);
+    }
+    if (!g_cache_hooked) {
+        synapticsmst_common_set_write_func (synapticsmst_core_cache_write_cb, NULL);
+        g_cache_hooked = 1;
+    }
+
+    entry = synapticsmst_core_cache_find (filename, layer, RAD, identity);
+    if (entry == NULL) {
+        /* take a free entry, or the least recently used one */
+        entry = &g_cache[0];
+        for (i = 1; i < CACHE_ENTRIES && entry->last_used != 0; i++) {
+            if (g_cache[i].last_used < entry->last_used) {
+                entry = &g_cache[i];
+            }
+        }
+        memset (entry, 0, sizeof (*entry));
+        snprintf (entry->filename, sizeof (entry->filename), "%s", filename);
+        entry->layer = layer;
+        entry->RAD = RAD;
+        entry->identity = *identity;
+    }
+    entry->last_used = ++g_cache_clock;
+
+    /* fetch whole blocks, so neighbouring queries hit */
+    for (i = offset / g_cache_block_size; i <= (offset + length - 1) / g_cache_block_size; i++) {
+        if (entry->valid[i]) {
+            continue;
+        }
+        nRet = synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, g_cache_block_size, i * g_cache_block_size,
+                                                   entry->data + i * g_cache_block_size);
+        if (nRet) {
+            break;
+        }
+        entry->valid[i] = 1;
+    }
+    if (nRet == DPCD_SUCCESS) {
+        memcpy (buf, entry->data + offset, length);
+    }
+    pthread_mutex_unlock (&g_cache_mutex);
+    return nRet;
+}
+
+unsigned short
+synapticsmst_core_board_id (const unsigned char *customer)
+{
+    if (customer[0] == 0x00 || customer[0] == 0x01) {
+        return (customer[0] << 8) | customer[1];
+    }
+    return 0xFFFF;
+}
+
+unsigned char
+synapticsmst_core_read_board_id (const synapticsmst_identity *identity, unsigned short *board_id)
+{
+    unsigned char byte[2];
+    unsigned char nRet;
+
+    nRet = synapticsmst_core_read_eeprom (identity, ADDR_CUSTOMER_ID, 2, byte);
+    if (nRet) {
+        return nRet;
+    }
+    *board_id = synapticsmst_core_board_id (byte);
+    return DPCD_SUCCESS;
+}
+
+/* the sideband header and body CRCs, bit by bit as in the DP spec */
+static unsigned char
+synapticsmst_core_sideband_crc4 (const unsigned char *data, int nibbles)
+{
+    unsigned char remainder = 0;
+    int i;
+
+    for (i = 0; i < nibbles * 4 + 4; i++) {
+        remainder <<= 1;
+        if (i < nibbles * 4) {
+            remainder |= (data[i / 8] >> (7 - i % 8)) & 0x01;
+        }
+        if (remainder & 0x10) {
+            remainder ^= 0x13;
+        }
+    }
+    return remainder & 0x0F;
+}
+
+static unsigned char
+synapticsmst_core_sideband_crc8 (const unsigned char *data, int length)
+{
+    unsigned short remainder = 0;
+    int i;
+
+    for (i = 0; i < length * 8 + 8; i++) {
+        remainder <<= 1;
+        if (i < length * 8) {
+            remainder |= (data[i / 8] >> (7 - i % 8)) & 0x01;
+        }
+        if (remainder & 0x100) {
+            remainder ^= 0xD5;
+        }
+    }
+    return remainder & 0xFF;
+}
+
+/* waits for the next chunk of a reply in DOWN_REP and appends its body,
+ * without the CRC, to reply; the chunk is acked so the hub can post more */
+static unsigned char
+synapticsmst_core_sideband_read_chunk (long long deadline, int poll_interval, unsigned char *reply, int *reply_length, int *eomt)
+{
+    struct timespec t_poll = { poll_interval / 1000000, (poll_interval % 1000000) * 1000 };
+    struct timespec t_spec;
+    unsigned char chunk[SIDEBAND_MSG_SIZE];
+    unsigned char esi = 0;
+    int header_length;
+    int body_length;
+    unsigned char nRet;
+
+    do {
+        nRet = synapticsmst_common_read_dpcd (REG_ESI0, (int *)&esi, 1);
+        if (nRet) {
+            return nRet;
+        }
+        if (esi & ESI0_DOWN_REP_MSG_RDY) {
+            break;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &t_spec);
+        if (t_spec.tv_sec * 1000LL + t_spec.tv_nsec / 1000000 > deadline) {
+            return DPCD_TIMEOUT;
+        }
+        nanosleep (&t_poll, NULL);
+    } while (1);
+
+    nRet = synapticsmst_common_read_dpcd (REG_SIDEBAND_DOWN_REP, (int *)chunk, sizeof (chunk));
+    if (nRet) {
+        return nRet;
+    }
+    esi = ESI0_DOWN_REP_MSG_RDY;
+    nRet = synapticsmst_common_write_dpcd (REG_ESI0, (int *)&esi, 1);
+    if (nRet) {
+        return nRet;
+    }
+
+    header_length = 1 + (chunk[0] >> 4) / 2 + 2;
+    body_length = chunk[header_length - 2] & 0x3F;
+    if (body_length < 1 || header_length + body_length > (int)sizeof (chunk) ||
+        *reply_length + body_length - 1 > SIDEBAND_REPLY_SIZE ||
+        synapticsmst_core_sideband_crc4 (chunk, header_length * 2 - 1) != (chunk[header_length - 1] & 0x0F) ||
+        synapticsmst_core_sideband_crc8 (chunk + header_length, body_length - 1) != chunk[header_length + body_length - 1] ||
+        ((chunk[header_length - 1] & 0x80) != 0) != (*reply_length == 0)) {
+        return DPCD_ACCESS_FAIL;
+    }
+    memcpy (reply + *reply_length, chunk + header_length, body_length - 1);
+    *reply_length += body_length - 1;
+    *eomt = (chunk[header_length - 1] & 0x40) != 0;
+    return DPCD_SUCCESS;
+}
+
+/* asks the hub at layer and RAD with a sideband LINK_ADDRESS whether an MST
+ * branch device is plugged into any of its output ports; returns 1 or 0, or
+ * -1 when the hub can't be asked */
+static int
+synapticsmst_core_branch_present (unsigned char layer, unsigned int RAD, int wait_time)
+{
+    /* LCT 1 addresses the hub itself, so there is no RAD in the header */
+    unsigned char request[5] = { 0x10, 0x02, 0xC0, SIDEBAND_LINK_ADDRESS, 0 };
+    unsigned char reply[SIDEBAND_REPLY_SIZE];
+    unsigned char byte = 0;
+    synapticsmst_transport transport;
+    struct timespec t_spec;
+    long long deadline;
+    int reply_length = 0;
+    int eomt = 0;
+    int present = 0;
+    int n_ports;
+    int i;
+    int idx;
+
+    /* with the source in MST mode the kernel owns the sideband mailboxes of
+     * every hub in the topology */
+    synapticsmst_common_config_connection (0, 0);
+    if (synapticsmst_common_read_dpcd (REG_MSTM_CTRL, (int *)&byte, 1) || (byte & 0x01)) {
+        return -1;
+    }
+    synapticsmst_common_config_connection (layer, RAD);
+    if (synapticsmst_common_read_dpcd (REG_MSTM_CAP, (int *)&byte, 1) || !(byte & 0x01)) {
+        return -1;
+    }
+    /* a reply nobody collected yet isn't ours to take */
+    if (synapticsmst_common_read_dpcd (REG_ESI0, (int *)&byte, 1) || (byte & ESI0_DOWN_REP_MSG_RDY)) {
+        return -1;
+    }
+
+    request[2] |= synapticsmst_core_sideband_crc4 (request, 5);
+    request[4] = synapticsmst_core_sideband_crc8 (request + 3, 1);
+    if (synapticsmst_common_write_dpcd (REG_SIDEBAND_DOWN_REQ, (int *)request, sizeof (request))) {
+        return -1;
+    }
+    synapticsmst_common_get_transport (&transport);
+    clock_gettime (CLOCK_MONOTONIC, &t_spec);
+    deadline = t_spec.tv_sec * 1000LL + t_spec.tv_nsec / 1000000 + wait_time;
+    while (!eomt) {
+        if (synapticsmst_core_sideband_read_chunk (deadline, transport.poll_interval, reply, &reply_length, &eomt)) {
+            return -1;
+        }
+    }
+
+    /* ACK for LINK_ADDRESS, the branch GUID, then the ports; only output
+     * ports carry the peer DPCD revision, GUID and SDP stream counts */
+    if (reply_length < 18 || reply[0] != SIDEBAND_LINK_ADDRESS) {
+        return -1;
+    }
+    n_ports = reply[17] & 0x0F;
+    idx = 18;
+    for (i = 0; i < n_ports; i++) {
+        const unsigned char *port = reply + idx;
+
+        if (idx + 2 > reply_length) {
+            return -1;
+        }
+        idx += (port[0] & 0x80) ? 2 : 20;
+        if (idx > reply_length) {
+            return -1;
+        }
+        if (!(port[0] & 0x80) && (port[1] & 0x40) && ((port[0] >> 4) & 0x07) == PEER_MST_BRANCH) {
+            present = 1;
+        }
+    }
+    return present;
+}
+
+int
+synapticsmst_core_scan_cascade (unsigned char layer, unsigned int RAD, unsigned char tx_port)
+{
+    unsigned char byte[4];
+    synapticsmst_transport transport;
+    synapticsmst_transport probe;
+    int wait_time = PROBE_WAIT_TIME * (layer + 1);
+    int found = 0;
+    unsigned char nRet;
+
+    /* which sideband port is which TX port isn't known, so the hub's own
+     * answer can only rule out both ports at once */
+    if (synapticsmst_core_branch_present (layer, RAD, wait_time) == 0) {
+        return 0;
+    }
+
+    /* an empty port never completes the command, so don't wait long, and
+     * don't try to recover a hub that was never there; every hop the
+     * command is tunnelled through adds to how long an answer takes */
+    synapticsmst_common_get_transport (&transport);
+    probe = transport;
+    probe.max_wait_time = wait_time;
+    probe.no_recovery = 1;
+    synapticsmst_common_set_transport (&probe);
+
+    synapticsmst_common_config_connection (layer + 1, RAD | (tx_port << (2 * layer)));
+    nRet = synapticsmst_common_read_dpcd (REG_RC_CAP, (int *)byte, 1);
+    if (nRet == DPCD_SUCCESS && (byte[0] & 0x04)) {
+        nRet = synapticsmst_common_read_dpcd (REG_VENDOR_ID, (int *)byte, 3);
+        if (nRet == DPCD_SUCCESS && byte[0] == 0x90 && byte[1] == 0xCC && byte[2] == 0x24) {
+            found = 1;
+        }
+    }
+
+    synapticsmst_common_set_transport (&transport);
+    return found;
+}
+
+unsigned char
+synapticsmst_core_get_checksum (int length, int offset, unsigned int *checksum)
+{
+    return synapticsmst_common_rc_get_checksum (UPDC_CAL_EEPROM_CHECKSUM, length, offset, checksum);
+}
+
+/* the CRC16 is cheap to compare but its parameters are only known from
+ * the vendor tool, so a mismatch is confirmed with the plain sum the
+ * whole image verify has always used */
+static unsigned char
+synapticsmst_core_verify_block (int offset, const unsigned char *data, int length)
+{
+    unsigned int flash_crc = 0;
+    unsigned int flash_checksum = 0;
+    unsigned char nRet;
+
+    nRet = synapticsmst_common_rc_get_checksum (UPDC_CAL_EEPROM_CHECK_CRC16, length, offset, &flash_crc);
+    if (nRet == 0 && (flash_crc & 0xFFFF) == synapticsmst_core_image_crc16 (0, data, length)) {
+        return 0;
+    }
+    if (nRet == DPCD_CANCELLED) {
+        return nRet;
+    }
+    nRet = synapticsmst_core_get_checksum (length, offset, &flash_checksum);
+    if (nRet) {
+        return nRet;
+    }
+    if (flash_checksum != synapticsmst_core_image_checksum (data, length)) {
+        return UPDC_COMMAND_FAILED;
+    }
+    return 0;
+}
+
+static int
+synapticsmst_core_is_blank (const unsigned char *data, int length)
+{
+    int i;
+
+    for (i = 0; i < length; i++) {
+        if (data[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void
+synapticsmst_core_progress (const synapticsmst_flash_params *params, synapticsmst_flash_phase phase, unsigned int done, unsigned int total)
+{
+    if (params->progress_func != NULL) {
+        params->progress_func (phase, done, total, params->user_data);
+    }
+}
+
+/* write one block unless it is blank, retrying as configured */
+static unsigned char
+synapticsmst_core_write_block (const synapticsmst_flash_params *params, synapticsmst_flash_result *result,
+                               int offset, const unsigned char *block, int size)
+{
+    unsigned char *buf = (unsigned char *)block;
+    int i;
+
+    if (synapticsmst_core_is_blank (block, size)) {
+        result->blank_blocks++;
+        return 0;
+    }
+    result->ret = synapticsmst_common_rc_set_command (UPDC_WRITE_TO_EEPROM, size, offset, buf);
+    for (i = 0; result->ret && result->ret != DPCD_CANCELLED && i < params->write_retries; i++) {
+        /* repeat, and make sure the block really landed */
+        result->retries++;
+        result->ret = synapticsmst_common_rc_set_command (UPDC_WRITE_TO_EEPROM, size, offset, buf);
+        if (result->ret == 0) {
+            result->ret = synapticsmst_core_verify_block (offset, block, size);
+        }
+    }
+    if (result->ret) {
+        result->offset = offset;
+        return result->ret;
+    }
+    result->bytes_written += size;
+    return 0;
+}
+
+synapticsmst_flash_status
+synapticsmst_core_flash (const unsigned char *data, int length, const synapticsmst_flash_params *params, synapticsmst_flash_result *result)
+{
+    unsigned char erase_code[2] = { 0xFF, 0xFF };
+    unsigned int checksum = 0;
+    unsigned int flash_checksum = 0;
+    int block_unit = params->block_unit > 0 ? params->block_unit : BLOCK_UNIT_DEFAULT;
+    int offset;
+
+    memset (result, 0, sizeof (*result));
+    result->blocks = (length + block_unit - 1) / block_unit;
+
+    /* start erasing the SPI flash, and sum the image while it runs */
+    synapticsmst_core_progress (params, FLASH_PHASE_ERASE, 0, length);
+    result->ret = synapticsmst_common_rc_start_command (UPDC_FLASH_ERASE, 2, 0, erase_code);
+    if (result->ret == 0) {
+        checksum = synapticsmst_core_image_checksum (data, length);
+        result->ret = synapticsmst_common_rc_wait_command ();
+    }
+    if (result->ret) {
+        return FLASH_ERASE_FAIL;
+    }
+    synapticsmst_core_progress (params, FLASH_PHASE_ERASE, length, length);
+
+    /* update firmware */
+    synapticsmst_core_progress (params, FLASH_PHASE_WRITE, 0, length);
+    for (offset = 0; offset < length; offset += block_unit) {
+        int size = length - offset < block_unit ? length - offset : block_unit;
+
+        if (synapticsmst_core_write_block (params, result, offset, data + offset, size)) {
+            return FLASH_WRITE_FAIL;
+        }
+        synapticsmst_core_progress (params, FLASH_PHASE_WRITE, offset + size, length);
+    }
+
+    /* check data just written */
+    synapticsmst_core_progress (params, FLASH_PHASE_VERIFY, 0, length);
+    result->ret = synapticsmst_core_get_checksum (length, 0, &flash_checksum);
+    if (result->ret) {
+        return FLASH_CHECKSUM_FAIL;
+    }
+    if (flash_checksum != checksum) {
+        return FLASH_CHECKSUM_MISMATCH;
+    }
+    synapticsmst_core_progress (params, FLASH_PHASE_VERIFY, length, length);
+    return FLASH_SUCCESS;
+}
+
+synapticsmst_flash_status
+synapticsmst_core_update_region (int offset, const unsigned char *data, int length, const synapticsmst_flash_params *params, synapticsmst_flash_result *result)
+{
+    synapticsmst_flash_status status = FLASH_SUCCESS;
+    int block_unit = params->block_unit > 0 ? params->block_unit : BLOCK_UNIT_DEFAULT;
+    int first = offset / SECTOR_SIZE;
+    int n_sectors = (offset + length + SECTOR_SIZE - 1) / SECTOR_SIZE - first;
+    int total = 0;
+    int done = 0;
+    unsigned char *sectors;
+    unsigned char *changed;
+    int i, j;
+
+    memset (result, 0, sizeof (*result));
+    if (offset < 0 || length <= 0 || offset + length > IMAGE_MAX_SIZE) {
+        result->ret = UPDC_COMMAND_INVALID;
+        return FLASH_WRITE_FAIL;
+    }
+    sectors = malloc (n_sectors * SECTOR_SIZE + n_sectors);
+    if (sectors == NULL) {
+        result->ret = UPDC_COMMAND_FAILED;
+        return FLASH_READ_FAIL;
+    }
+    changed = sectors + n_sectors * SECTOR_SIZE;
+
+    /* read back what the sectors hold, and merge the region in */
+    for (i = 0; i < n_sectors; i++) {
+        int start = (first + i) * SECTOR_SIZE;
+        int from = offset > start ? offset : start;
+        int to = offset + length < start + SECTOR_SIZE ? offset + length : start + SECTOR_SIZE;
+        unsigned char *sector = sectors + i * SECTOR_SIZE;
+
+        result->ret = synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, SECTOR_SIZE, start, sector);
+        if (result->ret) {
+            result->offset = start;
+            status = FLASH_READ_FAIL;
+            goto out;
+        }
+        changed[i] = memcmp (sector + from - start, data + from - offset, to - from) != 0;
+        if (changed[i]) {
+            memcpy (sector + from - start, data + from - offset, to - from);
+            result->blocks += SECTOR_SIZE / block_unit;
+            total += SECTOR_SIZE;
+        }
+    }
+    if (total == 0) {
+        goto out;
+    }
+
+    /* erase only the sectors that change */
+    synapticsmst_core_progress (params, FLASH_PHASE_ERASE, 0, total);
+    for (i = 0; i < n_sectors; i++) {
+        unsigned char erase_code[2];
+
+        if (!changed[i]) {
+            continue;
+        }
+        erase_code[0] = (SECTOR_ERASE_4K + first + i) & 0xFF;
+        erase_code[1] = (SECTOR_ERASE_4K + first + i) >> 8;
+        result->ret = synapticsmst_common_rc_set_command (UPDC_FLASH_ERASE, 2, 0, erase_code);
+        if (result->ret) {
+            status = FLASH_ERASE_FAIL;
+            goto out;
+        }
+        done += SECTOR_SIZE;
+        synapticsmst_core_progress (params, FLASH_PHASE_ERASE, done, total);
+    }
+
+    /* write the merged sectors back */
+    done = 0;
+    synapticsmst_core_progress (params, FLASH_PHASE_WRITE, 0, total);
+    for (i = 0; i < n_sectors; i++) {
+        if (!changed[i]) {
+            continue;
+        }
+        for (j = 0; j < SECTOR_SIZE; j += block_unit) {
+            int size = SECTOR_SIZE - j < block_unit ? SECTOR_SIZE - j : block_unit;
+
+            if (synapticsmst_core_write_block (params, result, (first + i) * SECTOR_SIZE + j, sectors + i * SECTOR_SIZE + j, size)) {
+                status = FLASH_WRITE_FAIL;
+                goto out;
+            }
+            done += size;
+            synapticsmst_core_progress (params, FLASH_PHASE_WRITE, done, total);
+        }
+    }
+
+    /* the hub computes the CRC of each sector it now holds */
+    done = 0;
+    synapticsmst_core_progress (params, FLASH_PHASE_VERIFY, 0, total);
+    for (i = 0; i < n_sectors; i++) {
+        if (!changed[i]) {
+            continue;
+        }
+        result->ret = synapticsmst_core_verify_block ((first + i) * SECTOR_SIZE, sectors + i * SECTOR_SIZE, SECTOR_SIZE);
+        if (result->ret == UPDC_COMMAND_FAILED) {
+            status = FLASH_CHECKSUM_MISMATCH;
+            goto out;
+        }
+        if (result->ret) {
+            status = FLASH_CHECKSUM_FAIL;
+            goto out;
+        }
+        done += SECTOR_SIZE;
+        synapticsmst_core_progress (params, FLASH_PHASE_VERIFY, done, total);
+    }
+
+out:
+    free (sectors);
+    return status;
+}
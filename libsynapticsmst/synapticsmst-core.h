@@ -0,0 +1,169 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __SYNAPTICSMST_CORE_H
+#define __SYNAPTICSMST_CORE_H
+
+/* identification, cascade probing and the flash engine on top of the
+ * transport in synapticsmst-common.h; plain C with no GLib so it can be
+ * linked statically into an early-boot flasher */
+
+#include "synapticsmst-common.h"
+
+#define IMAGE_MAX_SIZE          0x10000
+#define IMAGE_CODE_OFFSET       0x400
+
+#define SECTOR_SIZE             0x1000
+#define SECTOR_ERASE_4K         0x1000  /* UPDC_FLASH_ERASE code, plus the sector number, low byte first */
+
+/* the EDID and configuration blocks, board ID included, are read-mostly */
+#define CACHE_SIZE              IMAGE_CODE_OFFSET
+
+typedef enum {
+    IMAGE_VALID = 0,
+    IMAGE_INVALID_SIZE,
+    IMAGE_EDID_CHECKSUM,
+    IMAGE_CONFIG_CHECKSUM,
+    IMAGE_FIRMWARE_SIZE,
+    IMAGE_FIRMWARE_CHECKSUM,
+}synapticsmst_image_status;
+
+typedef enum {
+    REGION_EDID = 0,            /* two 128 byte EDID blocks at 0x000 */
+    REGION_CONFIG,              /* two 256 byte configuration blocks at 0x100 */
+    REGION_CODE,                /* firmware code with its size header at 0x400 */
+    REGION_LAST,
+}synapticsmst_region;
+
+typedef enum {
+    FLASH_SUCCESS = 0,
+    FLASH_ERASE_FAIL,
+    FLASH_WRITE_FAIL,
+    FLASH_CHECKSUM_FAIL,        /* the flash checksum couldn't be read */
+    FLASH_CHECKSUM_MISMATCH,
+    FLASH_READ_FAIL,            /* the sectors to keep couldn't be read back */
+}synapticsmst_flash_status;
+
+/* numbered as the matching SynapticsMSTDevicePhase */
+typedef enum {
+    FLASH_PHASE_ERASE = 1,
+    FLASH_PHASE_WRITE,
+    FLASH_PHASE_VERIFY,
+}synapticsmst_flash_phase;
+
+/* called with done 0 when a phase starts, and again as it progresses */
+typedef void (*synapticsmst_flash_progress_func)(synapticsmst_flash_phase phase, unsigned int done, unsigned int total, void *user_data);
+
+typedef struct {
+    unsigned char vendor_id[3];
+    unsigned char chip_id[2];
+    unsigned char version[3];   /* major, minor, build */
+    unsigned char guid[GUID_SIZE];
+    int has_guid;               /* 0 if the branch GUID is blank */
+}synapticsmst_identity;
+
+typedef struct {
+    int block_unit;             /* bytes per write command */
+    int write_retries;
+    synapticsmst_flash_progress_func progress_func;
+    void *user_data;
+}synapticsmst_flash_params;
+
+typedef struct {
+    unsigned char ret;          /* dpcd_return or RC_STATUS of the failing command */
+    unsigned int offset;        /* of the block that failed to read or write */
+    unsigned int blocks;
+    unsigned int blank_blocks;  /* skipped, erased flash already reads 0xFF */
+    unsigned int bytes_written;
+    unsigned int retries;
+}synapticsmst_flash_result;
+
+unsigned short
+synapticsmst_core_image_get_board_id(const unsigned char *data, int length);
+
+unsigned short
+synapticsmst_core_image_crc16(unsigned short crc, const unsigned char *data, int length);
+
+unsigned int
+synapticsmst_core_image_checksum(const unsigned char *data, int length);
+
+synapticsmst_image_status
+synapticsmst_core_image_validate(const unsigned char *data, int length);
+
+const char *
+synapticsmst_core_image_status_to_string(synapticsmst_image_status status);
+
+/* finds the region in a whole image, or takes data as the region on its
+ * own, and checks it; offset is where the region lives in the EEPROM */
+synapticsmst_image_status
+synapticsmst_core_image_get_region(synapticsmst_region region, const unsigned char *data, int length,
+                                   const unsigned char **region_data, int *offset, int *region_length);
+
+/* the functions below work on the connection set with
+ * synapticsmst_common_config_connection() */
+
+unsigned char
+synapticsmst_core_read_identity(synapticsmst_identity *identity);
+
+/* the board ID from the two EEPROM bytes at ADDR_CUSTOMER_ID, 0xFFFF if the
+ * customer is unknown */
+unsigned short
+synapticsmst_core_board_id(const unsigned char *customer);
+
+/* EEPROM reads below CACHE_SIZE are cached per hub, keyed by its aux node,
+ * route and identity; any EEPROM write or erase sent by this process drops
+ * the blocks it touches. 0 disables the cache */
+void
+synapticsmst_core_set_cache_block_size(int block_size);
+
+/* returns 1 and fills buf if the range is cached; never touches the hub */
+int
+synapticsmst_core_cache_lookup(const char *filename, unsigned char layer, unsigned int RAD, const synapticsmst_identity *identity, int offset, int length, unsigned char *buf);
+
+/* reads through the cache when identity is set */
+unsigned char
+synapticsmst_core_read_eeprom(const synapticsmst_identity *identity, int offset, int length, unsigned char *buf);
+
+unsigned char
+synapticsmst_core_read_board_id(const synapticsmst_identity *identity, unsigned short *board_id);
+
+/* returns 1 if a Synaptics hub answers on tx_port of the hub at layer and
+ * RAD, which must have remote control enabled; ports are only probed when
+ * the hub does not report, over the sideband channel, that no branch
+ * device is plugged in at all */
+int
+synapticsmst_core_scan_cascade(unsigned char layer, unsigned int RAD, unsigned char tx_port);
+
+unsigned char
+synapticsmst_core_get_checksum(int length, int offset, unsigned int *checksum);
+
+/* erase, write and verify; remote control must be enabled */
+synapticsmst_flash_status
+synapticsmst_core_flash(const unsigned char *data, int length, const synapticsmst_flash_params *params, synapticsmst_flash_result *result);
+
+/* the same for only the 4K sectors covering offset and length, keeping the
+ * rest of their contents; sectors already holding data are left alone */
+synapticsmst_flash_status
+synapticsmst_core_update_region(int offset, const unsigned char *data, int length, const synapticsmst_flash_params *params, synapticsmst_flash_result *result);
+
+#endif /* __SYNAPTICSMST_CORE_H */
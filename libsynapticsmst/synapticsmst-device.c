@@ -27,8 +27,23 @@
 
 #include "synapticsmst-device.h"
 #include "synapticsmst-common.h"
+#include "synapticsmst-core.h"
+#include "synapticsmst-image.h"
+#include "synapticsmst-profile.h"
 
 #define BLOCK_UNIT         64
+#define PROGRESS_INTERVAL  500  /* ms */
+#define CALIBRATE_SIZE     0x1000
+#define CALIBRATE_PASSES   3
+#define ESTIMATE_SAMPLES   8
+#define ESTIMATE_ERASE     2.0       /* s, SPI chip erase, not measurable safely */
+#define ESTIMATE_PROGRAM   0.000004  /* s per byte, SPI page program */
+#define ACTIVATE_ADDRESS   0x2000FC
+#define ACTIVATE_RESET     0xF5
+#define ACTIVATE_TIMEOUT   15000     /* ms */
+#define ACTIVATE_POLL_MIN  20        /* ms */
+#define ACTIVATE_POLL_MAX  320       /* ms */
+#define ACTIVATE_GRACE     2000      /* ms, a hub still answering after this never reset */
 
 typedef struct
 {
@@ -37,8 +52,25 @@ typedef struct
 	gchar			          *version;
 	SynapticsMSTDeviceBoardID boardID;
 	gchar                     *chipID;
+	gchar                     *guid;
 	guint8                    layer;
 	guint16                   rad;
+	synapticsmst_identity     identity;
+	gboolean                  has_identity;
+	gboolean                  has_boardID;
+	SynapticsMSTDeviceProgressFunc progress_func;
+	gpointer                  progress_user_data;
+	GDestroyNotify            progress_destroy;
+	GMainContext              *progress_context;
+	guint                     progress_interval;
+	SynapticsMSTDeviceProgress progress;
+	gint64                    progress_phase_start;
+	gint64                    progress_last_time;
+	guint32                   progress_last_bytes;
+	SynapticsMSTProfile       profile;
+	SynapticsMSTDeviceStats   stats;
+	synapticsmst_stats        stats_base;
+	gboolean                  stats_active;
 } SynapticsMSTDevicePrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (SynapticsMSTDevice, synapticsmst_device, G_TYPE_OBJECT)
@@ -101,6 +133,74 @@ synapticsmst_device_boardID_to_string (SynapticsMSTDeviceBoardID boardID)
 	return NULL;
 }
 
+/**
+ * synapticsmst_device_phase_to_string:
+ * @phase: the #SynapticsMSTDevicePhase.
+ *
+ * Converts the enumerated value to an text representation.
+ *
+ * Returns: string version of @phase
+ *
+ * Since: 0.9.1
+ **/
+const gchar *
+synapticsmst_device_phase_to_string (SynapticsMSTDevicePhase phase)
+{
+	if (phase == SYNAPTICSMST_DEVICE_PHASE_VALIDATE)
+		return "validate";
+	if (phase == SYNAPTICSMST_DEVICE_PHASE_ERASE)
+		return "erase";
+	if (phase == SYNAPTICSMST_DEVICE_PHASE_WRITE)
+		return "write";
+	if (phase == SYNAPTICSMST_DEVICE_PHASE_VERIFY)
+		return "verify";
+	return NULL;
+}
+
+/**
+ * synapticsmst_device_region_from_string:
+ * @region: the string.
+ *
+ * Converts the text representation to an enumerated value.
+ *
+ * Returns: a #SynapticsMSTDeviceRegion, or %SYNAPTICSMST_DEVICE_REGION_LAST for unknown.
+ *
+ * Since: 0.9.1
+ **/
+SynapticsMSTDeviceRegion
+synapticsmst_device_region_from_string (const gchar *region)
+{
+	if (g_strcmp0 (region, "edid") == 0)
+		return SYNAPTICSMST_DEVICE_REGION_EDID;
+	if (g_strcmp0 (region, "config") == 0)
+		return SYNAPTICSMST_DEVICE_REGION_CONFIG;
+	if (g_strcmp0 (region, "code") == 0)
+		return SYNAPTICSMST_DEVICE_REGION_CODE;
+	return SYNAPTICSMST_DEVICE_REGION_LAST;
+}
+
+/**
+ * synapticsmst_device_region_to_string:
+ * @region: the #SynapticsMSTDeviceRegion.
+ *
+ * Converts the enumerated value to an text representation.
+ *
+ * Returns: string version of @region
+ *
+ * Since: 0.9.1
+ **/
+const gchar *
+synapticsmst_device_region_to_string (SynapticsMSTDeviceRegion region)
+{
+	if (region == SYNAPTICSMST_DEVICE_REGION_EDID)
+		return "edid";
+	if (region == SYNAPTICSMST_DEVICE_REGION_CONFIG)
+		return "config";
+	if (region == SYNAPTICSMST_DEVICE_REGION_CODE)
+		return "code";
+	return NULL;
+}
+
 static void
 synapticsmst_device_finalize (GObject *object)
 {
@@ -109,12 +209,18 @@ synapticsmst_device_finalize (GObject *object)
 
 	g_free (priv->version);
 	g_free (priv->chipID);
+	g_free (priv->guid);
+	if (priv->progress_destroy != NULL)
+		priv->progress_destroy (priv->progress_user_data);
 	G_OBJECT_CLASS (synapticsmst_device_parent_class)->finalize (object);
 }
 
 static void
 synapticsmst_device_init (SynapticsMSTDevice *device)
 {
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	priv->progress_interval = PROGRESS_INTERVAL;
+	synapticsmst_profile_init (&priv->profile);
 }
 
 static void
@@ -124,6 +230,371 @@ synapticsmst_device_class_init (SynapticsMSTDeviceClass *klass)
 	object_class->finalize = synapticsmst_device_finalize;
 }
 
+static int
+synapticsmst_device_cancelled_cb (void *user_data)
+{
+	return g_cancellable_is_cancelled (G_CANCELLABLE (user_data));
+}
+
+static void
+synapticsmst_device_set_transport_error (GError **error, guint8 ret, const gchar *message)
+{
+	if (ret == DPCD_CANCELLED) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Operation was cancelled\n");
+		return;
+	}
+	if (ret == DPCD_BUSY) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_BUSY, "DP Aux Node is in use by another process\n");
+		return;
+	}
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, message);
+}
+
+/**
+ * synapticsmst_device_set_progress_func:
+ * @device: a #SynapticsMSTDevice instance.
+ * @func: (nullable): the #SynapticsMSTDeviceProgressFunc
+ * @user_data: the data to pass to @func
+ * @destroy: (nullable): the function to free @user_data
+ *
+ * Sets the function called with progress during a firmware update.
+ * For the async methods @func is called in the thread-default main
+ * context of the caller, otherwise it is called directly.
+ *
+ * Since: 0.9.1
+ **/
+void
+synapticsmst_device_set_progress_func (SynapticsMSTDevice *device,
+				       SynapticsMSTDeviceProgressFunc func,
+				       gpointer user_data,
+				       GDestroyNotify destroy)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+
+	g_return_if_fail (SYNAPTICSMST_IS_DEVICE (device));
+
+	if (priv->progress_destroy != NULL)
+		priv->progress_destroy (priv->progress_user_data);
+	priv->progress_func = func;
+	priv->progress_user_data = user_data;
+	priv->progress_destroy = destroy;
+}
+
+/**
+ * synapticsmst_device_set_progress_interval:
+ * @device: a #SynapticsMSTDevice instance.
+ * @interval: the minimum time between reports in ms, or 0 for every block
+ *
+ * Limits how often the progress function is called. The start and end
+ * of each phase are always reported.
+ *
+ * Since: 0.9.1
+ **/
+void
+synapticsmst_device_set_progress_interval (SynapticsMSTDevice *device, guint interval)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	g_return_if_fail (SYNAPTICSMST_IS_DEVICE (device));
+	priv->progress_interval = interval;
+}
+
+typedef struct {
+	SynapticsMSTDevice		*device;
+	SynapticsMSTDeviceProgress	 progress;
+} SynapticsMSTDeviceProgressHelper;
+
+static gboolean
+synapticsmst_device_progress_idle_cb (gpointer user_data)
+{
+	SynapticsMSTDeviceProgressHelper *helper = (SynapticsMSTDeviceProgressHelper *) user_data;
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (helper->device);
+
+	if (priv->progress_func != NULL)
+		priv->progress_func (helper->device, &helper->progress, priv->progress_user_data);
+	return G_SOURCE_REMOVE;
+}
+
+static void
+synapticsmst_device_progress_helper_free (SynapticsMSTDeviceProgressHelper *helper)
+{
+	g_object_unref (helper->device);
+	g_free (helper);
+}
+
+static void
+synapticsmst_device_progress_emit (SynapticsMSTDevice *device)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	SynapticsMSTDeviceProgressHelper *helper;
+
+	if (priv->progress_func == NULL)
+		return;
+	if (priv->progress_context == NULL) {
+		priv->progress_func (device, &priv->progress, priv->progress_user_data);
+		return;
+	}
+
+	/* running in a worker thread, so report in the caller's context */
+	helper = g_new0 (SynapticsMSTDeviceProgressHelper, 1);
+	helper->device = g_object_ref (device);
+	helper->progress = priv->progress;
+	g_main_context_invoke_full (priv->progress_context,
+				    G_PRIORITY_DEFAULT,
+				    synapticsmst_device_progress_idle_cb,
+				    helper,
+				    (GDestroyNotify) synapticsmst_device_progress_helper_free);
+}
+
+static void
+synapticsmst_device_progress_update (SynapticsMSTDevice *device, guint32 bytes_done)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	SynapticsMSTDeviceProgress *progress = &priv->progress;
+	gint64 now = g_get_monotonic_time ();
+	gdouble elapsed;
+
+	/* always report the end of a phase */
+	if (bytes_done < progress->bytes_total &&
+	    now - priv->progress_last_time < (gint64) priv->progress_interval * 1000)
+		return;
+
+	elapsed = (gdouble) (now - priv->progress_last_time) / G_USEC_PER_SEC;
+	if (elapsed > 0)
+		progress->throughput = (bytes_done - priv->progress_last_bytes) / elapsed;
+	elapsed = (gdouble) (now - priv->progress_phase_start) / G_USEC_PER_SEC;
+	if (elapsed > 0)
+		progress->throughput_avg = bytes_done / elapsed;
+	if (progress->throughput_avg > 0)
+		progress->eta = (progress->bytes_total - bytes_done) / progress->throughput_avg;
+	else
+		progress->eta = 0;
+	progress->bytes_done = bytes_done;
+	if (bytes_done >= progress->bytes_total)
+		priv->stats.phase_time[progress->phase] = elapsed;
+	priv->progress_last_time = now;
+	priv->progress_last_bytes = bytes_done;
+	synapticsmst_device_progress_emit (device);
+}
+
+static void
+synapticsmst_device_progress_start (SynapticsMSTDevice *device, SynapticsMSTDevicePhase phase, guint32 bytes_total)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+
+	priv->progress.phase = phase;
+	priv->progress.bytes_done = 0;
+	priv->progress.bytes_total = bytes_total;
+	priv->progress.throughput = 0;
+	priv->progress.throughput_avg = 0;
+	priv->progress.eta = 0;
+	priv->progress_phase_start = g_get_monotonic_time ();
+	priv->progress_last_time = priv->progress_phase_start;
+	priv->progress_last_bytes = 0;
+	synapticsmst_device_progress_emit (device);
+}
+
+/* attribute the RC traffic between begin and end to this device; nested
+ * calls are ignored so a batch can account per device inside its session */
+static void
+synapticsmst_device_stats_begin (SynapticsMSTDevice *device)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+
+	if (priv->stats_active)
+		return;
+	synapticsmst_common_get_stats (&priv->stats_base);
+	priv->stats_active = TRUE;
+}
+
+static void
+synapticsmst_device_stats_end (SynapticsMSTDevice *device)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	synapticsmst_stats stats;
+
+	if (!priv->stats_active)
+		return;
+	synapticsmst_common_get_stats (&stats);
+	priv->stats.rc_commands += stats.rc_commands - priv->stats_base.rc_commands;
+	priv->stats.timeouts += stats.timeouts - priv->stats_base.timeouts;
+	priv->stats.recoveries += stats.recoveries - priv->stats_base.recoveries;
+	priv->stats.throttle_time += (gdouble) (stats.throttled_us - priv->stats_base.throttled_us) / G_USEC_PER_SEC;
+	priv->stats_active = FALSE;
+}
+
+static gboolean
+synapticsmst_device_open_session (SynapticsMSTDevice *device, gboolean remote_control, synapticsmst_traffic traffic,
+				  GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	gint fd;
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error))
+		return FALSE;
+	fd = synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (priv->aux_node));
+	if (fd == -2) {
+		synapticsmst_device_set_transport_error (error, DPCD_BUSY, NULL);
+		return FALSE;
+	}
+	if (fd <= 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to open device in DP Aux Node %d\n", priv->aux_node);
+		return FALSE;
+	}
+	if (cancellable != NULL)
+		synapticsmst_common_set_cancel_func (synapticsmst_device_cancelled_cb, cancellable);
+	synapticsmst_profile_apply (&priv->profile);
+
+	/* before enabling RC, so all of a foreground session is charged to
+	 * the foreground budget */
+	synapticsmst_common_set_traffic (traffic);
+	synapticsmst_device_stats_begin (device);
+	if (remote_control && !synapticsmst_device_enable_remote_control (device, error)) {
+		synapticsmst_device_stats_end (device);
+		synapticsmst_common_close_aux_node ();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+synapticsmst_device_close_session (SynapticsMSTDevice *device, gboolean remote_control)
+{
+	if (remote_control)
+		synapticsmst_device_disable_remote_control (device, NULL);
+	synapticsmst_device_stats_end (device);
+	synapticsmst_common_close_aux_node ();
+}
+
+static gboolean
+synapticsmst_device_read_identity (SynapticsMSTDevice *device, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	synapticsmst_identity *identity = &priv->identity;
+	gint64 start = g_get_monotonic_time ();
+	guint8 ret;
+
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	priv->has_identity = FALSE;
+	ret = synapticsmst_core_read_identity (identity);
+	priv->stats.identity_latency = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+	if (ret) {
+		synapticsmst_device_set_transport_error (error, ret, "Failed to read dpcd from device\n");
+		return FALSE;
+	}
+
+	g_free (priv->version);
+	priv->version = g_strdup_printf ("v%1d.%02d.%03d", identity->version[0], identity->version[1], identity->version[2]);
+	g_free (priv->chipID);
+	priv->chipID = g_strdup_printf ("VMM%02x%02x", identity->chip_id[0], identity->chip_id[1]);
+	priv->has_identity = TRUE;
+
+	g_clear_pointer (&priv->guid, g_free);
+	if (identity->has_guid) {
+		GString *str = g_string_new (NULL);
+		for (guint i = 0; i < GUID_SIZE; i++)
+			g_string_append_printf (str, "%02x", identity->guid[i]);
+		priv->guid = g_string_free (str, FALSE);
+	}
+	return TRUE;
+}
+
+static void
+synapticsmst_device_set_boardID (SynapticsMSTDevice *device, guint16 board_id)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+
+	priv->boardID = board_id;
+	priv->has_boardID = TRUE;
+
+	/* use the calibrated settings for this board from now on */
+	if (priv->boardID != 0xFFFF && synapticsmst_profile_load (&priv->profile, priv->boardID, NULL))
+		synapticsmst_profile_apply (&priv->profile);
+}
+
+static gboolean
+synapticsmst_device_read_boardID (SynapticsMSTDevice *device, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	guint16 board_id;
+
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	if (synapticsmst_core_read_board_id (priv->has_identity ? &priv->identity : NULL, &board_id)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to read from EEPROM of device\n");
+		return FALSE;
+	}
+	synapticsmst_device_set_boardID (device, board_id);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_device_ensure_dpcd_identity (SynapticsMSTDevice *device, GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	gboolean remote_control = priv->layer > 0;
+	gboolean ret;
+
+	if (priv->has_identity)
+		return TRUE;
+
+	/* a direct device can be read without remote control */
+	if (!synapticsmst_device_open_session (device, remote_control, TRAFFIC_BACKGROUND, cancellable, error))
+		return FALSE;
+	ret = synapticsmst_device_read_identity (device, error);
+	synapticsmst_device_close_session (device, remote_control);
+	return ret;
+}
+
+static gboolean
+synapticsmst_device_ensure_boardID (SynapticsMSTDevice *device, GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	guint8 byte[2];
+	gboolean ret;
+
+	if (priv->has_boardID)
+		return TRUE;
+
+	/* the EEPROM cache may already hold it for this identity */
+	if (priv->has_identity &&
+	    synapticsmst_core_cache_lookup (synapticsmst_device_aux_node_to_string (priv->aux_node),
+					    priv->layer, priv->rad, &priv->identity,
+					    ADDR_CUSTOMER_ID, sizeof (byte), byte)) {
+		synapticsmst_device_set_boardID (device, synapticsmst_core_board_id (byte));
+		return TRUE;
+	}
+
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_BACKGROUND, cancellable, error))
+		return FALSE;
+	ret = synapticsmst_device_read_boardID (device, error);
+	synapticsmst_device_close_session (device, TRUE);
+	return ret;
+}
+
+/**
+ * synapticsmst_device_ensure_identity:
+ * @device: a #SynapticsMSTDevice instance.
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: the #GError, or %NULL
+ *
+ * Reads the chip ID, firmware version, GUID and board ID if they are not
+ * known yet. The getters never touch the hub, so this must have succeeded
+ * before they return anything useful. It must not be called while another
+ * device has the aux node open.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_ensure_identity (SynapticsMSTDevice *device, GCancellable *cancellable, GError **error)
+{
+	g_return_val_if_fail (SYNAPTICSMST_IS_DEVICE (device), FALSE);
+
+	if (!synapticsmst_device_ensure_dpcd_identity (device, cancellable, error))
+		return FALSE;
+	return synapticsmst_device_ensure_boardID (device, cancellable, error);
+}
+
 /**
  * synapticsmst_device_get_kind:
  * @device: a #SynapticsMSTDevice instance.
@@ -141,10 +612,22 @@ synapticsmst_device_get_kind (SynapticsMSTDevice *device)
 	return priv->kind;
 }
 
+/**
+ * synapticsmst_device_get_boardID:
+ * @device: a #SynapticsMSTDevice instance.
+ *
+ * Gets the board ID read by synapticsmst_device_ensure_identity().
+ *
+ * Returns: the #SynapticsMSTDeviceBoardID, or %SYNAPTICSMST_DEVICE_BOARDID_UNKNOW if not read yet
+ *
+ * Since: 0.9.1
+ **/
 SynapticsMSTDeviceBoardID
 synapticsmst_device_get_boardID (SynapticsMSTDevice *device)
 {
 	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	if (!priv->has_boardID)
+		return SYNAPTICSMST_DEVICE_BOARDID_UNKNOW;
 	return priv->boardID;
 }
 
@@ -152,10 +635,12 @@ gboolean
 synapticsmst_device_enable_remote_control (SynapticsMSTDevice *device, GError **error)
 {
 	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	guint8 ret;
 
 	synapticsmst_common_config_connection(priv->layer, priv->rad);
-	if (synapticsmst_common_enable_remote_control ()) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to enable MST remote control\n");
+	ret = synapticsmst_common_enable_remote_control ();
+	if (ret) {
+		synapticsmst_device_set_transport_error (error, ret, "Failed to enable MST remote control\n");
 		return FALSE;
 	}
 	else {
@@ -182,81 +667,106 @@ gboolean
 synapticsmst_device_scan_cascade_device (SynapticsMSTDevice *device, guint8 tx_port)
 {
 	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
-	guint8 layer = priv->layer + 1;
-	guint16 rad = priv->rad | (tx_port << (2 * (priv->layer)));
-	unsigned char byte[4];
-	guint8 ret;
 
-	synapticsmst_common_config_connection (layer, rad);
-	ret = synapticsmst_common_read_dpcd (REG_RC_CAP, (int *)byte, 1);
-	if (ret == DPCD_SUCCESS ) {
-        if (byte[0] & 0x04) {
-            synapticsmst_common_read_dpcd (REG_VENDOR_ID, (int *)byte, 3);
-            if (byte[0] == 0x90 && byte[1] == 0xCC && byte[2] == 0x24) {
-                return TRUE;
-            }
-        }
-	}
+	return synapticsmst_core_scan_cascade (priv->layer, priv->rad, tx_port);
+}
 
-	return FALSE;
+/* shared by the sync and async versions, which differ only in cancellable */
+static gboolean
+synapticsmst_device_enumerate_device_internal (SynapticsMSTDevice *device, GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	gint64 start = g_get_monotonic_time ();
+	gboolean ret;
+
+	priv->has_identity = FALSE;
+	priv->has_boardID = FALSE;
+	ret = synapticsmst_device_ensure_identity (device, cancellable, error);
+	priv->stats.enumerate_time = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+	return ret;
 }
 
+/**
+ * synapticsmst_device_enumerate_device:
+ * @device: a #SynapticsMSTDevice instance.
+ * @error: the #GError, or %NULL
+ *
+ * Refreshes the vendor ID, chip ID and firmware version with a single
+ * DPCD read, and the board ID, which comes from the EEPROM cache unless
+ * the identity changed.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
 gboolean
 synapticsmst_device_enumerate_device (SynapticsMSTDevice *device, GError **error)
 {
-	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
-
-	guint8 byte[16];
+	return synapticsmst_device_enumerate_device_internal (device, NULL, error);
+}
 
-	if (synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (priv->aux_node))) {
-		guint8 nRet;
-		/* enable remote control */
-		if (!synapticsmst_device_enable_remote_control (device, error)) {
-			return FALSE;
-		}
+static void
+synapticsmst_device_enumerate_device_thread_cb (GTask *task,
+						gpointer source_object,
+						gpointer task_data,
+						GCancellable *cancellable)
+{
+	SynapticsMSTDevice *device = SYNAPTICSMST_DEVICE (source_object);
+	GError *error = NULL;
 
-		/* read firmware version */
-		nRet = synapticsmst_common_read_dpcd (REG_FIRMWARE_VERSIOIN, (int *)byte, 3);
-		if (nRet) {
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to read dpcd from device\n");
-			return FALSE;
-		}
-		priv->version = g_strdup_printf ("v%1d.%02d.%03d", byte[0], byte[1], byte[2]);
+	if (!synapticsmst_device_enumerate_device_internal (device, cancellable, &error)) {
+		g_task_return_error (task, error);
+		return;
+	}
+	g_task_return_boolean (task, TRUE);
+}
 
-		/* read board ID */
-		synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, 2, ADDR_CUSTOMER_ID, byte);
-		if (nRet) {
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to read from EEPROM of device\n");
-			return FALSE;
-		}
-		if (byte[0] == 0x01) {
-			priv->boardID = (byte[0] << 8) | (byte[1]);
-		}
-		else if (byte[0] == 0x00) {
-			priv->boardID = (byte[0] << 8) | (byte[1]);
-		}
-		else {
-			priv->boardID = 0xFFFF;
-		}
+/**
+ * synapticsmst_device_enumerate_device_async:
+ * @device: a #SynapticsMSTDevice instance.
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously refreshes the device identity. The transaction runs in a
+ * worker thread and @callback is invoked in the thread-default main context.
+ *
+ * Since: 0.9.1
+ **/
+void
+synapticsmst_device_enumerate_device_async (SynapticsMSTDevice *device,
+					    GCancellable *cancellable,
+					    GAsyncReadyCallback callback,
+					    gpointer user_data)
+{
+	g_autoptr(GTask) task = NULL;
 
-		/* read board chipID */
-		synapticsmst_common_read_dpcd (REG_CHIP_ID, (int *)byte, 2);
-		if (nRet) {
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to read dpcd from device\n");
-			return FALSE;
-		}
-		priv->chipID = g_strdup_printf ("VMM%02x%02x", byte[0], byte[1]);
+	g_return_if_fail (SYNAPTICSMST_IS_DEVICE (device));
 
-		/* disable remote control and close aux node */
-		synapticsmst_device_disable_remote_control (device, error);
-		synapticsmst_common_close_aux_node ();
-	}
-	else {
-		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to open device in DP Aux Node %d\n", synapticsmst_device_get_aux_node (device));
-		return FALSE;
-	}
+	task = g_task_new (device, cancellable, callback, user_data);
+	g_task_set_source_tag (task, synapticsmst_device_enumerate_device_async);
+	g_task_run_in_thread (task, synapticsmst_device_enumerate_device_thread_cb);
+}
 
-	return TRUE;
+/**
+ * synapticsmst_device_enumerate_device_finish:
+ * @device: a #SynapticsMSTDevice instance.
+ * @res: the #GAsyncResult
+ * @error: the #GError, or %NULL
+ *
+ * Gets the result from the asynchronous function.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_enumerate_device_finish (SynapticsMSTDevice *device,
+					     GAsyncResult *res,
+					     GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (res, device), FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
 }
 
 guint8
@@ -266,24 +776,84 @@ synapticsmst_device_get_aux_node (SynapticsMSTDevice *device)
 	return priv->aux_node;
 }
 
+/**
+ * synapticsmst_device_get_version:
+ * @device: a #SynapticsMSTDevice instance.
+ *
+ * Gets the firmware version read by synapticsmst_device_ensure_identity().
+ *
+ * Returns: the version string, or %NULL if not read yet
+ *
+ * Since: 0.9.1
+ **/
 const gchar *
 synapticsmst_device_get_version (SynapticsMSTDevice *device)
 {
 	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	if (!priv->has_identity)
+		return NULL;
 	return priv->version;
 }
 
+/**
+ * synapticsmst_device_get_chipID:
+ * @device: a #SynapticsMSTDevice instance.
+ *
+ * Gets the chip ID read by synapticsmst_device_ensure_identity().
+ *
+ * Returns: the chip ID string, or %NULL if not read yet
+ *
+ * Since: 0.9.1
+ **/
 const gchar *
 synapticsmst_device_get_chipID (SynapticsMSTDevice *device)
 {
 	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	if (!priv->has_identity)
+		return NULL;
 	return priv->chipID;
 }
 
-guint16
-synapticsmst_device_get_rad (SynapticsMSTDevice *device)
-{
-	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+/**
+ * synapticsmst_device_get_guid:
+ * @device: a #SynapticsMSTDevice instance.
+ *
+ * Gets the branch device GUID read by synapticsmst_device_ensure_identity().
+ *
+ * Returns: the GUID as 32 hex digits, or %NULL if the hub has none or it was not read yet
+ *
+ * Since: 0.9.1
+ **/
+const gchar *
+synapticsmst_device_get_guid (SynapticsMSTDevice *device)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	if (!priv->has_identity)
+		return NULL;
+	return priv->guid;
+}
+
+/**
+ * synapticsmst_device_get_stats:
+ * @device: a #SynapticsMSTDevice instance.
+ *
+ * Gets the transport statistics gathered while using the device.
+ *
+ * Returns: the #SynapticsMSTDeviceStats
+ *
+ * Since: 0.9.1
+ **/
+const SynapticsMSTDeviceStats *
+synapticsmst_device_get_stats (SynapticsMSTDevice *device)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	return &priv->stats;
+}
+
+guint16
+synapticsmst_device_get_rad (SynapticsMSTDevice *device)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
 	return priv->rad;
 }
 
@@ -297,8 +867,11 @@ synapticsmst_device_get_layer (SynapticsMSTDevice *device)
 gboolean
 synapticsmst_device_get_flash_checksum (SynapticsMSTDevice *device, int length, int offset, guint32 *checksum, GError **error)
 {
-	if (synapticsmst_common_rc_special_get_command (UPDC_CAL_EEPROM_CHECKSUM, length, offset, NULL, 4, (unsigned char *)checksum)) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to get flash checksum\n");
+	guint8 ret;
+
+	ret = synapticsmst_core_get_checksum (length, offset, checksum);
+	if (ret) {
+		synapticsmst_device_set_transport_error (error, ret, "Failed to get flash checksum\n");
 		return FALSE;
 	}
 	else {
@@ -306,179 +879,1236 @@ synapticsmst_device_get_flash_checksum (SynapticsMSTDevice *device, int length,
 	}
 }
 
+typedef struct {
+	int		 length;
+	int		 offset;
+	guint32		 checksum;
+} SynapticsMSTDeviceChecksumHelper;
+
+static void
+synapticsmst_device_get_flash_checksum_thread_cb (GTask *task,
+						  gpointer source_object,
+						  gpointer task_data,
+						  GCancellable *cancellable)
+{
+	SynapticsMSTDevice *device = SYNAPTICSMST_DEVICE (source_object);
+	SynapticsMSTDeviceChecksumHelper *helper = (SynapticsMSTDeviceChecksumHelper *) task_data;
+	GError *error = NULL;
+	gboolean ret;
+
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_BACKGROUND, cancellable, &error)) {
+		g_task_return_error (task, error);
+		return;
+	}
+	ret = synapticsmst_device_get_flash_checksum (device, helper->length, helper->offset, &helper->checksum, &error);
+	synapticsmst_device_close_session (device, TRUE);
+	if (!ret) {
+		g_task_return_error (task, error);
+		return;
+	}
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * synapticsmst_device_get_flash_checksum_async:
+ * @device: a #SynapticsMSTDevice instance.
+ * @length: the number of bytes to checksum
+ * @offset: the flash offset to start at
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously asks the device to checksum a range of its flash. Unlike
+ * synapticsmst_device_get_flash_checksum() this opens the DP Aux node and
+ * enables remote control itself.
+ *
+ * Since: 0.9.1
+ **/
+void
+synapticsmst_device_get_flash_checksum_async (SynapticsMSTDevice *device,
+					      int length,
+					      int offset,
+					      GCancellable *cancellable,
+					      GAsyncReadyCallback callback,
+					      gpointer user_data)
+{
+	SynapticsMSTDeviceChecksumHelper *helper;
+	g_autoptr(GTask) task = NULL;
+
+	g_return_if_fail (SYNAPTICSMST_IS_DEVICE (device));
+
+	helper = g_new0 (SynapticsMSTDeviceChecksumHelper, 1);
+	helper->length = length;
+	helper->offset = offset;
+	task = g_task_new (device, cancellable, callback, user_data);
+	g_task_set_source_tag (task, synapticsmst_device_get_flash_checksum_async);
+	g_task_set_task_data (task, helper, g_free);
+	g_task_run_in_thread (task, synapticsmst_device_get_flash_checksum_thread_cb);
+}
+
+/**
+ * synapticsmst_device_get_flash_checksum_finish:
+ * @device: a #SynapticsMSTDevice instance.
+ * @res: the #GAsyncResult
+ * @checksum: (out): the flash checksum
+ * @error: the #GError, or %NULL
+ *
+ * Gets the result from the asynchronous function.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
 gboolean
-synapticsmst_device_write_firmware (SynapticsMSTDevice *device, GBytes *fw, GError **error)
+synapticsmst_device_get_flash_checksum_finish (SynapticsMSTDevice *device,
+					       GAsyncResult *res,
+					       guint32 *checksum,
+					       GError **error)
+{
+	SynapticsMSTDeviceChecksumHelper *helper;
+
+	g_return_val_if_fail (g_task_is_valid (res, device), FALSE);
+
+	if (!g_task_propagate_boolean (G_TASK (res), error))
+		return FALSE;
+	helper = g_task_get_task_data (G_TASK (res));
+	if (checksum != NULL)
+		*checksum = helper->checksum;
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_device_check_firmware (SynapticsMSTDevice *device, GBytes *fw, GError **error)
 {
 	const guint8 *payload_data;
-	guint32 payload_len;
-	guint32 code_size = 0;
-	guint32 checksum = 0;
-	guint32 flash_checksum = 0;
-	guint32 offset = 0;
-	guint32 write_loops = 0;
-	guint32 data_to_write = 0;
-	guint8 percentage = 0;
-	guint8 nRet = 0;
-	guint16 tmp;
-	guint16 erase_code = 0xFFFF;
+	gsize payload_len;
+
+	payload_data = g_bytes_get_data (fw, &payload_len);
+	synapticsmst_device_progress_start (device, SYNAPTICSMST_DEVICE_PHASE_VALIDATE, payload_len);
+	if (!synapticsmst_image_validate (payload_data, payload_len, error)) {
+		g_prefix_error (error, "Failed to flash firmware : ");
+		return FALSE;
+	}
+	synapticsmst_device_progress_update (device, payload_len);
+	return TRUE;
+}
 
+static gboolean
+synapticsmst_device_check_boardID (SynapticsMSTDevice *device, GBytes *fw, GError **error)
+{
 	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	const guint8 *payload_data;
+	gsize payload_len;
 
-	/* get firmware data and check size */
-	payload_data = g_bytes_get_data (fw, NULL);
-	payload_len = g_bytes_get_size (fw);
-	if (payload_len > 0x10000 || payload_len == 0) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : invalid file size\n");
+	payload_data = g_bytes_get_data (fw, &payload_len);
+	if (synapticsmst_image_get_board_id (payload_data, payload_len) != priv->boardID) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : board ID mismatch\n");
 		return FALSE;
 	}
+	return TRUE;
+}
+
+static void
+synapticsmst_device_flash_progress_cb (synapticsmst_flash_phase phase, guint done, guint total, void *user_data)
+{
+	SynapticsMSTDevice *device = SYNAPTICSMST_DEVICE (user_data);
+
+	if (done == 0)
+		synapticsmst_device_progress_start (device, (SynapticsMSTDevicePhase) phase, total);
+	else
+		synapticsmst_device_progress_update (device, done);
+}
 
-	/* check firmware content */
-	for (guint8 i=0; i<128; i++) {
-		checksum += *(payload_data + i);
+/* account a core flash run to the device and turn its status into an error */
+static gboolean
+synapticsmst_device_flash_finish (SynapticsMSTDevice *device,
+				  synapticsmst_flash_status status,
+				  const synapticsmst_flash_result *result,
+				  GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+
+	g_debug ("skipped %u of %u blank blocks", result->blank_blocks, result->blocks);
+	priv->stats.retries += result->retries;
+	priv->stats.bytes_written += result->bytes_written;
+
+	switch (status) {
+	case FLASH_SUCCESS:
+		return TRUE;
+	case FLASH_READ_FAIL:
+		if (result->ret == DPCD_CANCELLED)
+			synapticsmst_device_set_transport_error (error, result->ret, NULL);
+		else
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : can't read flash at offset 0x%04x\n", result->offset);
+		break;
+	case FLASH_ERASE_FAIL:
+		synapticsmst_device_set_transport_error (error, result->ret, "Failed to flash firmware : can't erase flash\n");
+		break;
+	case FLASH_WRITE_FAIL:
+		if (result->ret == DPCD_CANCELLED)
+			synapticsmst_device_set_transport_error (error, result->ret, NULL);
+		else
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : can't write flash at offset 0x%04x\n", result->offset);
+		break;
+	case FLASH_CHECKSUM_FAIL:
+		synapticsmst_device_set_transport_error (error, result->ret, "Failed to get flash checksum\n");
+		break;
+	case FLASH_CHECKSUM_MISMATCH:
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : checksum mismatch\n");
+		break;
 	}
-	if (checksum & 0xFF) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : EDID checksum error\n");
+	return FALSE;
+}
+
+static void
+synapticsmst_device_flash_params_init (SynapticsMSTDevice *device, synapticsmst_flash_params *params)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	synapticsmst_profile_apply (&priv->profile);
+	memset (params, 0, sizeof (*params));
+	params->block_unit = priv->profile.block_unit;
+	params->write_retries = priv->profile.write_retries;
+	params->progress_func = synapticsmst_device_flash_progress_cb;
+	params->user_data = device;
+}
+
+/* erase, write and verify; the aux node must be open with remote control
+ * enabled for this device */
+static gboolean
+synapticsmst_device_flash_locked (SynapticsMSTDevice *device, GBytes *fw, GError **error)
+{
+	const guint8 *payload_data;
+	gsize payload_len;
+	synapticsmst_flash_params params;
+	synapticsmst_flash_result result;
+	synapticsmst_flash_status status;
+
+	payload_data = g_bytes_get_data (fw, &payload_len);
+	synapticsmst_device_flash_params_init (device, &params);
+	status = synapticsmst_core_flash (payload_data, payload_len, &params, &result);
+	return synapticsmst_device_flash_finish (device, status, &result, error);
+}
+
+static gboolean
+synapticsmst_device_write_firmware_internal (SynapticsMSTDevice *device, GBytes *fw, GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	gboolean ret = TRUE;
+
+	/* check firmware content and board ID before touching the flash; a
+	 * known board ID costs nothing, an unknown one is read in this session */
+	if (!synapticsmst_device_check_firmware (device, fw, error))
+		return FALSE;
+	if (priv->has_boardID && !synapticsmst_device_check_boardID (device, fw, error))
 		return FALSE;
+
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_FOREGROUND, cancellable, error))
+		return FALSE;
+	if (!priv->has_boardID) {
+		ret = synapticsmst_device_read_boardID (device, error) &&
+		      synapticsmst_device_check_boardID (device, fw, error);
+	}
+	if (ret)
+		ret = synapticsmst_device_flash_locked (device, fw, error);
+
+	/* disable remote control and close aux node */
+	synapticsmst_device_close_session (device, TRUE);
+	return ret;
+}
+
+typedef struct {
+	SynapticsMSTDevice	*device;
+	GBytes			*fw;
+} SynapticsMSTDeviceBatchItem;
+
+static gint
+synapticsmst_device_sort_downstream_first_cb (gconstpointer a, gconstpointer b)
+{
+	SynapticsMSTDevice *device_a = ((SynapticsMSTDeviceBatchItem *) a)->device;
+	SynapticsMSTDevice *device_b = ((SynapticsMSTDeviceBatchItem *) b)->device;
+	guint8 layer_a = synapticsmst_device_get_layer (device_a);
+	guint8 layer_b = synapticsmst_device_get_layer (device_b);
+
+	if (layer_a != layer_b)
+		return layer_b - layer_a;
+	return synapticsmst_device_get_rad (device_a) - synapticsmst_device_get_rad (device_b);
+}
+
+static gboolean
+synapticsmst_device_batch_enable_remote_control (SynapticsMSTDevice *device, GArray *enabled, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+
+	/* every hub on the route needs remote control, but only once */
+	for (guint8 layer = 0; layer <= priv->layer; layer++) {
+		guint16 rad = priv->rad & ((1 << (2 * layer)) - 1);
+		guint32 key = ((guint32) layer << 16) | rad;
+		gboolean found = FALSE;
+		guint8 ret;
+
+		for (guint i = 0; i < enabled->len; i++) {
+			if (g_array_index (enabled, guint32, i) == key) {
+				found = TRUE;
+				break;
+			}
+		}
+		if (found)
+			continue;
+		synapticsmst_common_config_connection (layer, rad);
+		ret = synapticsmst_common_enable_remote_control_layer (layer);
+		if (ret) {
+			synapticsmst_device_set_transport_error (error, ret, "Failed to enable MST remote control\n");
+			return FALSE;
+		}
+		g_array_append_val (enabled, key);
 	}
+	return TRUE;
+}
 
-	checksum = 0;
-	offset = 128;
-	for (guint8 i=0; i<128; i++) {
-		checksum += *(payload_data + offset + i);
+static void
+synapticsmst_device_batch_disable_remote_control (GArray *enabled)
+{
+	/* downstream hubs were enabled last, so disable them first */
+	for (guint i = enabled->len; i > 0; i--) {
+		guint32 key = g_array_index (enabled, guint32, i - 1);
+		guint8 layer = key >> 16;
+		synapticsmst_common_config_connection (layer, key & 0xFFFF);
+		synapticsmst_common_disable_remote_control_layer (layer);
 	}
-	if (checksum & 0xFF) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : EDID checksum error\n");
+}
+
+/**
+ * synapticsmst_device_write_firmware_batch:
+ * @devices: (element-type SynapticsMSTDevice): devices behind one DP Aux node
+ * @firmwares: (element-type GBytes): the firmware image for each device
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: the #GError, or %NULL
+ *
+ * Updates several cascaded devices using one aux node session. Remote
+ * control is enabled once per hub on the route, and the devices are
+ * flashed downstream first so the upstream path keeps working. All
+ * images are checked before anything is erased, and the batch stops at
+ * the first failure.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_write_firmware_batch (GPtrArray *devices,
+					  GPtrArray *firmwares,
+					  GCancellable *cancellable,
+					  GError **error)
+{
+	SynapticsMSTDevice *device;
+	guint8 aux_node;
+	gboolean ret = TRUE;
+	g_autoptr(GArray) order = NULL;
+	g_autoptr(GArray) enabled = NULL;
+
+	g_return_val_if_fail (devices != NULL, FALSE);
+	g_return_val_if_fail (firmwares != NULL, FALSE);
+	g_return_val_if_fail (devices->len == firmwares->len, FALSE);
+
+	if (devices->len == 0)
+		return TRUE;
+
+	/* check every image up front */
+	device = g_ptr_array_index (devices, 0);
+	aux_node = synapticsmst_device_get_aux_node (device);
+	order = g_array_sized_new (FALSE, FALSE, sizeof (SynapticsMSTDeviceBatchItem), devices->len);
+	for (guint i = 0; i < devices->len; i++) {
+		SynapticsMSTDeviceBatchItem item;
+		item.device = g_ptr_array_index (devices, i);
+		item.fw = g_ptr_array_index (firmwares, i);
+		if (synapticsmst_device_get_aux_node (item.device) != aux_node) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : devices are on different DP Aux nodes\n");
+			return FALSE;
+		}
+		if (!synapticsmst_device_check_firmware (item.device, item.fw, error))
+			return FALSE;
+		g_array_append_val (order, item);
+	}
+	g_array_sort (order, synapticsmst_device_sort_downstream_first_cb);
+
+	/* one session for the whole tree */
+	device = g_array_index (order, SynapticsMSTDeviceBatchItem, 0).device;
+	if (!synapticsmst_device_open_session (device, FALSE, TRAFFIC_FOREGROUND, cancellable, error))
 		return FALSE;
+	enabled = g_array_new (FALSE, FALSE, sizeof (guint32));
+	for (guint i = 0; i < order->len && ret; i++) {
+		GBytes *fw = g_array_index (order, SynapticsMSTDeviceBatchItem, i).fw;
+		device = g_array_index (order, SynapticsMSTDeviceBatchItem, i).device;
+		synapticsmst_device_stats_begin (device);
+		ret = synapticsmst_device_batch_enable_remote_control (device, enabled, error);
+		if (ret && !GET_PRIVATE (device)->has_boardID)
+			ret = synapticsmst_device_read_boardID (device, error);
+		if (ret)
+			ret = synapticsmst_device_check_boardID (device, fw, error);
+		if (ret)
+			ret = synapticsmst_device_flash_locked (device, fw, error);
+		synapticsmst_device_stats_end (device);
+		if (!ret)
+			g_prefix_error (error, "Device in DP Aux Node %d layer %d: ", aux_node, synapticsmst_device_get_layer (device));
+	}
+	synapticsmst_device_batch_disable_remote_control (enabled);
+	synapticsmst_device_close_session (device, FALSE);
+	return ret;
+}
+
+static gboolean
+synapticsmst_device_estimate_locked (SynapticsMSTDevice *device, GBytes *fw, SynapticsMSTDeviceEstimate *estimate, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	const guint8 *payload_data;
+	gsize payload_len;
+	guint n_commands = 0;
+	guint32 checksum;
+	guint8 buf[32];
+	guint8 nRet;
+	gint64 start;
+	g_autoptr(SynapticsMSTImagePlan) plan = NULL;
+
+	payload_data = g_bytes_get_data (fw, &payload_len);
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	synapticsmst_profile_apply (&priv->profile);
+
+	/* round trip of one full RC transfer at this layer, tunnels included */
+	start = g_get_monotonic_time ();
+	for (guint i = 0; i < ESTIMATE_SAMPLES; i++) {
+		nRet = synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, MIN (priv->profile.unit_size, sizeof (buf)), 0, buf);
+		if (nRet) {
+			synapticsmst_device_set_transport_error (error, nRet, "Failed to read from EEPROM of device\n");
+			return FALSE;
+		}
 	}
+	estimate->rc_latency = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC / ESTIMATE_SAMPLES;
 
-	checksum = 0;
-	offset = 0x100;
-	for (guint16 i=0; i<256; i++) {
-		checksum += *(payload_data + offset + i);
+	/* the verify checksum costs the same whatever is in the flash */
+	start = g_get_monotonic_time ();
+	if (!synapticsmst_device_get_flash_checksum (device, payload_len, 0, &checksum, error))
+		return FALSE;
+	estimate->verify_time = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+
+	/* only blocks that aren't blank after the erase are written */
+	plan = synapticsmst_image_plan_new (payload_data, payload_len, priv->profile.block_unit);
+	estimate->bytes_total = payload_len;
+	estimate->bytes_written = 0;
+	for (guint i = 0; i < plan->n_blocks; i++) {
+		guint32 length = MIN (plan->block_size, payload_len - i * plan->block_size);
+		if (plan->block_blank[i])
+			continue;
+		estimate->bytes_written += length;
+		n_commands += (length + priv->profile.unit_size - 1) / priv->profile.unit_size;
 	}
-	if (checksum & 0xFF) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : configuration checksum error\n");
+	estimate->write_time = n_commands * estimate->rc_latency + estimate->bytes_written * ESTIMATE_PROGRAM;
+	estimate->erase_time = ESTIMATE_ERASE;
+	return TRUE;
+}
+
+/**
+ * synapticsmst_device_estimate_flash:
+ * @device: a #SynapticsMSTDevice instance.
+ * @fw: the firmware image
+ * @estimate: (out): the #SynapticsMSTDeviceEstimate
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError or %NULL
+ *
+ * Checks @fw as synapticsmst_device_write_firmware() would and predicts
+ * how long flashing it takes, without erasing or writing anything.
+ * The RC round trip and the verify checksum are measured on the device.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_estimate_flash (SynapticsMSTDevice *device,
+				    GBytes *fw,
+				    SynapticsMSTDeviceEstimate *estimate,
+				    GCancellable *cancellable,
+				    GError **error)
+{
+	gboolean ret;
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (estimate != NULL, FALSE);
+
+	if (!synapticsmst_device_check_firmware (device, fw, error))
+		return FALSE;
+	if (!synapticsmst_device_ensure_boardID (device, cancellable, error))
+		return FALSE;
+	if (!synapticsmst_device_check_boardID (device, fw, error))
+		return FALSE;
+
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_FOREGROUND, cancellable, error))
 		return FALSE;
+	ret = synapticsmst_device_estimate_locked (device, fw, estimate, error);
+	synapticsmst_device_close_session (device, TRUE);
+	return ret;
+}
+
+static gint
+synapticsmst_device_sort_dpcd_range_cb (gconstpointer a, gconstpointer b)
+{
+	const SynapticsMSTDeviceDpcdRange *range_a = a;
+	const SynapticsMSTDeviceDpcdRange *range_b = b;
+	if (range_a->address < range_b->address)
+		return -1;
+	if (range_a->address > range_b->address)
+		return 1;
+	return 0;
+}
+
+/* merge overlapping and adjacent ranges so each span is one read; never
+ * bridge a gap, as registers nobody asked for are not read */
+static GArray *
+synapticsmst_device_coalesce_dpcd_ranges (GArray *ranges)
+{
+	GArray *spans = g_array_sized_new (FALSE, FALSE, sizeof (SynapticsMSTDeviceDpcdRange), ranges->len);
+	g_autoptr(GArray) sorted = g_array_sized_new (FALSE, FALSE, sizeof (SynapticsMSTDeviceDpcdRange), ranges->len);
+
+	g_array_append_vals (sorted, ranges->data, ranges->len);
+	g_array_sort (sorted, synapticsmst_device_sort_dpcd_range_cb);
+	for (guint i = 0; i < sorted->len; i++) {
+		SynapticsMSTDeviceDpcdRange *range = &g_array_index (sorted, SynapticsMSTDeviceDpcdRange, i);
+		if (spans->len > 0) {
+			SynapticsMSTDeviceDpcdRange *last = &g_array_index (spans, SynapticsMSTDeviceDpcdRange, spans->len - 1);
+			if (range->address <= last->address + last->length) {
+				guint32 end = MAX (last->address + last->length, range->address + range->length);
+				last->length = end - last->address;
+				continue;
+			}
+		}
+		g_array_append_val (spans, *range);
+	}
+	return spans;
+}
+
+/**
+ * synapticsmst_device_read_dpcd_ranges:
+ * @device: a #SynapticsMSTDevice instance.
+ * @ranges: (element-type SynapticsMSTDeviceDpcdRange): the DPCD ranges
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError or %NULL
+ *
+ * Reads several DPCD ranges of the device in one session, tunnelled
+ * through the upstream hubs for a remote device. Overlapping and adjacent
+ * ranges are read together, so each contiguous span costs a single read.
+ *
+ * Returns: (transfer container) (element-type GBytes): the data of each
+ * range in the order of @ranges, or %NULL for error
+ *
+ * Since: 0.9.1
+ **/
+GPtrArray *
+synapticsmst_device_read_dpcd_ranges (SynapticsMSTDevice *device,
+				      GArray *ranges,
+				      GCancellable *cancellable,
+				      GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	gboolean remote_control = priv->layer > 0;
+	guint8 nRet = 0;
+	g_autoptr(GArray) spans = NULL;
+	g_autoptr(GPtrArray) data = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+	g_autoptr(GPtrArray) result = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_DEVICE (device), NULL);
+	g_return_val_if_fail (ranges != NULL, NULL);
+
+	for (guint i = 0; i < ranges->len; i++) {
+		SynapticsMSTDeviceDpcdRange *range = &g_array_index (ranges, SynapticsMSTDeviceDpcdRange, i);
+		if (range->length == 0 ||
+		    range->address >= DPCD_ADDRESS_SPACE ||
+		    range->length > DPCD_ADDRESS_SPACE - range->address) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				     "Invalid DPCD range 0x%05x+%u\n", range->address, range->length);
+			return NULL;
+		}
 	}
+	spans = synapticsmst_device_coalesce_dpcd_ranges (ranges);
 
-	checksum = 0;
-	offset = 0x200;
-	for (guint16 i=0; i<256; i++) {
-		checksum += *(payload_data + offset + i);
+	if (!synapticsmst_device_open_session (device, remote_control, TRAFFIC_BACKGROUND, cancellable, error))
+		return NULL;
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	for (guint i = 0; i < spans->len; i++) {
+		SynapticsMSTDeviceDpcdRange *span = &g_array_index (spans, SynapticsMSTDeviceDpcdRange, i);
+		guint8 *buf = g_malloc (span->length);
+		nRet = synapticsmst_common_read_dpcd (span->address, (int *)buf, span->length);
+		if (nRet) {
+			g_free (buf);
+			break;
+		}
+		g_ptr_array_add (data, g_bytes_new_take (buf, span->length));
 	}
-	if (checksum & 0xFF) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : configuration checksum error\n");
+	synapticsmst_device_close_session (device, remote_control);
+	if (nRet) {
+		synapticsmst_device_set_transport_error (error, nRet, "Failed to read dpcd from device\n");
+		return NULL;
+	}
+
+	/* hand back each range as a slice of the span that covers it */
+	for (guint i = 0; i < ranges->len; i++) {
+		SynapticsMSTDeviceDpcdRange *range = &g_array_index (ranges, SynapticsMSTDeviceDpcdRange, i);
+		for (guint j = 0; j < spans->len; j++) {
+			SynapticsMSTDeviceDpcdRange *span = &g_array_index (spans, SynapticsMSTDeviceDpcdRange, j);
+			if (range->address >= span->address &&
+			    range->address + range->length <= span->address + span->length) {
+				g_ptr_array_add (result, g_bytes_new_from_bytes (g_ptr_array_index (data, j),
+										 range->address - span->address,
+										 range->length));
+				break;
+			}
+		}
+	}
+	return g_steal_pointer (&result);
+}
+
+/**
+ * synapticsmst_device_audit:
+ * @device: a #SynapticsMSTDevice instance.
+ * @checksum: (out): the checksum of the whole SPI flash
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError or %NULL
+ *
+ * Refreshes the identity and board ID of the device and checksums its
+ * flash. Entering and leaving remote control on the device run in the same
+ * command list as the RC commands, in a single session.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_audit (SynapticsMSTDevice *device, guint32 *checksum, GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	guint8 board_id[2];
+	guint8 reply[4];
+	guint8 ret = DPCD_SUCCESS;
+	gint n_done;
+	synapticsmst_rc_op ops[] = {
+		{ UPDC_ENABLE_RC, 0, 0, NULL, 0, NULL, 0 },
+		{ UPDC_READ_FROM_EEPROM, 2, ADDR_CUSTOMER_ID, NULL, 2, board_id, 0 },
+		{ UPDC_CAL_EEPROM_CHECKSUM, SYNAPTICSMST_IMAGE_MAX_SIZE, 0, NULL, 4, reply, 0 },
+		{ UPDC_DISABLE_RC, 0, 0, NULL, 0, NULL, 0 },
+	};
+	const gchar *messages[] = {
+		"Failed to enable MST remote control\n",
+		"Failed to read from EEPROM of device\n",
+		"Failed to get flash checksum\n",
+		"Failed to disable MST remote control\n",
+	};
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (checksum != NULL, FALSE);
+
+	if (!synapticsmst_device_open_session (device, FALSE, TRAFFIC_BACKGROUND, cancellable, error))
+		return FALSE;
+
+	/* only the hubs in front of this one need remote control up front,
+	 * for tunnelling the identity reads and the list */
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	for (guint i = 0; i < priv->layer && ret == DPCD_SUCCESS; i++)
+		ret = synapticsmst_common_enable_remote_control_layer (i);
+	if (ret) {
+		synapticsmst_common_disable_remote_control ();
+		synapticsmst_device_close_session (device, FALSE);
+		synapticsmst_device_set_transport_error (error, ret, "Failed to enable MST remote control\n");
+		return FALSE;
+	}
+	priv->has_identity = FALSE;
+	if (!synapticsmst_device_read_identity (device, error)) {
+		synapticsmst_common_disable_remote_control ();
+		synapticsmst_device_close_session (device, FALSE);
+		return FALSE;
+	}
+	n_done = synapticsmst_common_rc_run_list (ops, G_N_ELEMENTS (ops));
+	if (n_done < (gint) G_N_ELEMENTS (ops)) {
+		synapticsmst_common_disable_remote_control ();
+		synapticsmst_device_close_session (device, FALSE);
+		synapticsmst_device_set_transport_error (error, ops[n_done].result, messages[n_done]);
 		return FALSE;
 	}
+	for (gint i = priv->layer - 1; i >= 0; i--)
+		synapticsmst_common_disable_remote_control_layer (i);
+	synapticsmst_device_close_session (device, FALSE);
 
-	checksum = 0;
-	offset = 0x400;
-	code_size = (*(payload_data + offset) << 8) + *(payload_data + offset + 1);
-	if (code_size >= 0xFFFF) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : invalid firmware size\n");
+	/* the hub answers little endian, as in rc_get_checksum */
+	*checksum = reply[0] | (reply[1] << 8) | (reply[2] << 16) | ((guint32) reply[3] << 24);
+	synapticsmst_device_set_boardID (device, synapticsmst_core_board_id (board_id));
+	return TRUE;
+}
+
+/* time CALIBRATE_PASSES reads of the reference block with the current
+ * transport settings, counting failed or corrupted reads */
+static guint8
+synapticsmst_device_calibrate_pass (const guint8 *reference, guint *errors, gdouble *throughput)
+{
+	g_autofree guint8 *buf = g_malloc (CALIBRATE_SIZE);
+	guint bytes_ok = 0;
+	gint64 start = g_get_monotonic_time ();
+	gint64 elapsed;
+
+	*errors = 0;
+	for (guint i = 0; i < CALIBRATE_PASSES; i++) {
+		guint8 nRet = synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, CALIBRATE_SIZE, 0, buf);
+		if (nRet == DPCD_CANCELLED)
+			return nRet;
+		if (nRet || memcmp (buf, reference, CALIBRATE_SIZE) != 0) {
+			(*errors)++;
+			continue;
+		}
+		bytes_ok += CALIBRATE_SIZE;
+	}
+	elapsed = MAX (g_get_monotonic_time () - start, 1);
+	*throughput = (gdouble) bytes_ok * G_USEC_PER_SEC / elapsed;
+	return DPCD_SUCCESS;
+}
+
+static gboolean
+synapticsmst_device_calibrate_locked (SynapticsMSTDevice *device, SynapticsMSTProfile *profile, GError **error)
+{
+	const guint unit_sizes[] = { 32, 16, 8 };
+	const guint poll_intervals[] = { 100, 500, 2000 };
+	guint best_errors = G_MAXUINT;
+	guint32 checksum;
+	gint64 checksum_time;
+	guint8 nRet;
+	g_autofree guint8 *reference = g_malloc (CALIBRATE_SIZE);
+
+	/* reference data and command latency with the defaults */
+	synapticsmst_common_set_transport (NULL);
+	nRet = synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, CALIBRATE_SIZE, 0, reference);
+	if (nRet) {
+		synapticsmst_device_set_transport_error (error, nRet, "Failed to read from EEPROM of device\n");
+		return FALSE;
+	}
+	checksum_time = g_get_monotonic_time ();
+	if (!synapticsmst_device_get_flash_checksum (device, SYNAPTICSMST_IMAGE_MAX_SIZE, 0, &checksum, error))
 		return FALSE;
+	checksum_time = g_get_monotonic_time () - checksum_time;
+
+	/* keep the most reliable settings, then the fastest */
+	for (guint i = 0; i < G_N_ELEMENTS (unit_sizes); i++) {
+		for (guint j = 0; j < G_N_ELEMENTS (poll_intervals); j++) {
+			synapticsmst_transport transport = { unit_sizes[i], 0, poll_intervals[j] };
+			gdouble throughput = 0.f;
+			guint errors = 0;
+
+			synapticsmst_common_set_transport (&transport);
+			nRet = synapticsmst_device_calibrate_pass (reference, &errors, &throughput);
+			if (nRet) {
+				synapticsmst_device_set_transport_error (error, nRet, NULL);
+				return FALSE;
+			}
+			g_debug ("unit size %u, poll interval %uus: %u errors, %.0f bytes/s",
+				 unit_sizes[i], poll_intervals[j], errors, throughput);
+			if (errors < best_errors ||
+			    (errors == best_errors && throughput > profile->throughput)) {
+				best_errors = errors;
+				profile->unit_size = unit_sizes[i];
+				profile->poll_interval = poll_intervals[j];
+				profile->throughput = throughput;
+			}
+		}
 	}
-	for (guint32 i=0; i<(code_size + 17); i++) {
-		checksum += *(payload_data + offset + i);
+
+	/* erase shares the RC timeout, so only ever allow more time than the
+	 * default, for boards that are slow to checksum the whole flash */
+	profile->max_wait_time = MAX (profile->max_wait_time, 2 * checksum_time / 1000);
+
+	/* writes can't be measured without erasing, so a board that drops reads
+	 * gets smaller blocks that are cheaper to retry, and more retries */
+	if (best_errors > 0) {
+		profile->block_unit = profile->unit_size;
+		profile->write_retries = 3;
+	}
+	else {
+		profile->block_unit = BLOCK_UNIT;
+	}
+	return TRUE;
+}
+
+/**
+ * synapticsmst_device_calibrate:
+ * @device: a #SynapticsMSTDevice instance.
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError or %NULL
+ *
+ * Measures the RC transport of the device with non-destructive reads and
+ * checksums, and stores the fastest reliable settings as the profile for
+ * its board ID. Later sessions with any device of that board use them.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_calibrate (SynapticsMSTDevice *device, GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	SynapticsMSTProfile profile;
+	gboolean ret;
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_DEVICE (device), FALSE);
+
+	if (!synapticsmst_device_ensure_boardID (device, cancellable, error))
+		return FALSE;
+	if (priv->boardID == 0xFFFF) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Failed to calibrate : unknown board ID\n");
+		return FALSE;
 	}
-	if (checksum & 0xFF) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : firmware checksum error\n");
+
+	synapticsmst_profile_init (&profile);
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_FOREGROUND, cancellable, error))
 		return FALSE;
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	ret = synapticsmst_device_calibrate_locked (device, &profile, error);
+	synapticsmst_device_close_session (device, TRUE);
+	if (!ret)
+		return FALSE;
+
+	if (!synapticsmst_profile_save (&profile, priv->boardID, error))
+		return FALSE;
+	priv->profile = profile;
+	return TRUE;
+}
+
+/* RC_CAP and the vendor ID answer again, and the identity block holds
+ * the version of the firmware now running */
+static gboolean
+synapticsmst_device_activate_probe (SynapticsMSTDevice *device, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	guint8 byte[3];
+	gboolean ret = FALSE;
+
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_FOREGROUND, NULL, error))
+		return FALSE;
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	if (synapticsmst_common_read_dpcd (REG_RC_CAP, (int *)byte, 1) != DPCD_SUCCESS || !(byte[0] & 0x04)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED, "Remote control not ready\n");
+	}
+	else if (synapticsmst_common_read_dpcd (REG_VENDOR_ID, (int *)byte, 3) != DPCD_SUCCESS ||
+		 byte[0] != 0x90 || byte[1] != 0xCC || byte[2] != 0x24) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED, "Vendor ID not ready\n");
+	}
+	else {
+		ret = synapticsmst_device_read_identity (device, error);
 	}
+	synapticsmst_device_close_session (device, TRUE);
+	return ret;
+}
+
+/**
+ * synapticsmst_device_activate:
+ * @device: a #SynapticsMSTDevice instance.
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: the #GError, or %NULL
+ *
+ * Resets the hub in-band so a newly written firmware runs, then polls
+ * until the hub answers again and rereads its firmware version. The poll
+ * interval starts short and doubles, so a fast hub is found quickly and a
+ * slow one does not flood the AUX channel. A hub that keeps answering with
+ * the same version for a grace period is taken to have ignored the reset.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_activate (SynapticsMSTDevice *device, GCancellable *cancellable, GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	guint8 reset[4] = { ACTIVATE_RESET, 0, 0, 0 };
+	gint64 deadline;
+	gint64 grace;
+	gulong interval = ACTIVATE_POLL_MIN;
+	gboolean went_away = FALSE;
+	g_autofree gchar *version = NULL;
 
-	/* check firmware and board ID again */
-	tmp = (*(payload_data + 0x10E) << 8) + *(payload_data + 0x10F);
+	g_return_val_if_fail (SYNAPTICSMST_IS_DEVICE (device), FALSE);
 
-	if (tmp != synapticsmst_device_get_boardID (device)) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : board ID mismatch\n");
+	if (!synapticsmst_device_ensure_identity (device, cancellable, error))
 		return FALSE;
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_FOREGROUND, cancellable, error))
+		return FALSE;
+
+	/* the hub resets before it can complete the command, so don't wait
+	 * for the result; RC is dropped by the reset, so only the upstream
+	 * hubs still need it disabled */
+	version = g_strdup (priv->version);
+	synapticsmst_common_config_connection (priv->layer, priv->rad);
+	if (synapticsmst_common_rc_start_command (UPDC_WRITE_TO_MEMORY, 4, ACTIVATE_ADDRESS, reset) != DPCD_SUCCESS) {
+		synapticsmst_device_close_session (device, TRUE);
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "Failed to activate firmware : reset could not be sent\n");
+		return FALSE;
+	}
+	if (priv->layer > 0) {
+		synapticsmst_common_config_connection (priv->layer - 1, priv->rad);
+		synapticsmst_common_disable_remote_control ();
 	}
+	synapticsmst_device_stats_end (device);
+	synapticsmst_common_close_aux_node ();
+
+	grace = g_get_monotonic_time () + ACTIVATE_GRACE * G_TIME_SPAN_MILLISECOND;
+	deadline = g_get_monotonic_time () + ACTIVATE_TIMEOUT * G_TIME_SPAN_MILLISECOND;
+	for (;;) {
+		g_autoptr(GError) error_local = NULL;
 
-	if (synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (priv->aux_node))) {
-		/* enable remote control */
-		if (!synapticsmst_device_enable_remote_control (device, error)) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
 			return FALSE;
-		}
+		g_usleep (interval * 1000);
+		if (synapticsmst_device_activate_probe (device, &error_local)) {
+			/* back after going away, or reset quicker than a poll */
+			if (went_away || g_strcmp0 (version, priv->version) != 0)
+				break;
 
-		/* erase SPI flash */
-		if (synapticsmst_common_rc_set_command (UPDC_FLASH_ERASE, 2, 0, (guint8 *)&erase_code)) {
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : can't erase flash\n");
+			/* the reset may take effect a little after the command */
+			if (g_get_monotonic_time () > grace) {
+				g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+						     "Failed to activate firmware : device did not reset, please reset device\n");
+				return FALSE;
+			}
+			interval = MIN (interval * 2, ACTIVATE_POLL_MAX);
+			continue;
+		}
+		went_away = TRUE;
+		if (g_get_monotonic_time () > deadline) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+				     "Failed to activate firmware : device did not come back, %s", error_local->message);
 			return FALSE;
 		}
+		g_debug ("waiting for device: %s", error_local->message);
+		interval = MIN (interval * 2, ACTIVATE_POLL_MAX);
+	}
+	return TRUE;
+}
 
-		/* update firmware */
-		write_loops = (payload_len / BLOCK_UNIT);
-		data_to_write = payload_len;
-		nRet = 0;
-		offset = 0;
+static gint
+synapticsmst_device_sort_route_cb (gconstpointer a, gconstpointer b)
+{
+	SynapticsMSTDevicePrivate *priv_a = GET_PRIVATE (*((SynapticsMSTDevice **) a));
+	SynapticsMSTDevicePrivate *priv_b = GET_PRIVATE (*((SynapticsMSTDevice **) b));
+
+	/* fewer hops first, then the lower aux node, then the port taken at
+	 * each hop from the top down, which is breadth first */
+	if (priv_a->layer != priv_b->layer)
+		return priv_a->layer - priv_b->layer;
+	if (priv_a->aux_node != priv_b->aux_node)
+		return priv_a->aux_node - priv_b->aux_node;
+	for (guint8 i = 0; i < priv_a->layer; i++) {
+		guint port_a = (priv_a->rad >> (2 * i)) & 0x3;
+		guint port_b = (priv_b->rad >> (2 * i)) & 0x3;
+		if (port_a != port_b)
+			return port_a - port_b;
+	}
+	return 0;
+}
 
-		if (payload_len % BLOCK_UNIT) {
-			write_loops++;
-		}
+/**
+ * synapticsmst_device_sort_by_route:
+ * @devices: (element-type SynapticsMSTDevice): devices
+ *
+ * Sorts devices into the order a scan finds them in, which is the order
+ * device indexes refer to. Anything handing out device indexes must use
+ * this, so an index means the same hub everywhere.
+ *
+ * Since: 0.9.1
+ **/
+void
+synapticsmst_device_sort_by_route (GPtrArray *devices)
+{
+	g_ptr_array_sort (devices, synapticsmst_device_sort_route_cb);
+}
 
-		g_print("updating... 0%%");
+/**
+ * synapticsmst_device_set_cache_block_size:
+ * @block_size: bytes per cached block, or 0 to disable the cache
+ *
+ * Sets how the EEPROM cache shared by all devices in this process fetches
+ * the EDID and configuration blocks. Changing it drops the cache.
+ *
+ * Since: 0.9.1
+ **/
+void
+synapticsmst_device_set_cache_block_size (gint block_size)
+{
+	synapticsmst_core_set_cache_block_size (block_size);
+}
 
-		for (guint32 i=0; i<write_loops; i++) {
-			guint8 length = BLOCK_UNIT;
-			if (data_to_write < BLOCK_UNIT) {
-				length = data_to_write;
-			}
+static gboolean
+synapticsmst_device_is_same_hub (SynapticsMSTDevice *device1, SynapticsMSTDevice *device2, GCancellable *cancellable)
+{
+	SynapticsMSTDevicePrivate *priv1 = GET_PRIVATE (device1);
+	SynapticsMSTDevicePrivate *priv2 = GET_PRIVATE (device2);
+	g_autoptr(GError) error_local = NULL;
 
-			nRet = synapticsmst_common_rc_set_command (UPDC_WRITE_TO_EEPROM, length, offset, (payload_data + offset));
-			if (nRet) {
-				/* repeat once */
-				nRet = synapticsmst_common_rc_set_command (UPDC_WRITE_TO_EEPROM, length, offset, (payload_data + offset));
-			}
+	/* identical docks share chip and board ID, so without a GUID two
+	 * devices can never be proven to be the same hub */
+	if (priv1->guid == NULL || priv2->guid == NULL)
+		return FALSE;
+	if (g_strcmp0 (priv1->guid, priv2->guid) != 0 ||
+	    g_strcmp0 (priv1->chipID, priv2->chipID) != 0)
+		return FALSE;
 
-			if (nRet) {
-				break;
-			}
+	/* only pay for the EEPROM reads once everything else matches */
+	if (!synapticsmst_device_ensure_boardID (device1, cancellable, &error_local) ||
+	    !synapticsmst_device_ensure_boardID (device2, cancellable, &error_local)) {
+		g_debug ("not deduplicating: %s", error_local->message);
+		return FALSE;
+	}
+	return priv1->boardID == priv2->boardID;
+}
 
-			offset += length;
-			data_to_write -= length;
-			percentage = i * 100 / (write_loops - 1);
-			g_print ("\rupdating... %d%%", percentage);
-		}
-		g_print ("\n");
+/**
+ * synapticsmst_device_dedupe:
+ * @devices: (element-type SynapticsMSTDevice): devices found by scanning
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: the #GError, or %NULL
+ *
+ * Merges devices that are different routes to the same physical hub, so
+ * that it is only enumerated and flashed once. A hub is identified by
+ * its branch GUID, chip ID and board ID, and keeps its shortest route.
+ * Devices whose identity cannot be read are kept as they are.
+ *
+ * Returns: (transfer full) (element-type SynapticsMSTDevice): the unique
+ * devices in the order of @devices, or %NULL for error
+ *
+ * Since: 0.9.1
+ **/
+GPtrArray *
+synapticsmst_device_dedupe (GPtrArray *devices, GCancellable *cancellable, GError **error)
+{
+	g_autoptr(GPtrArray) order = g_ptr_array_sized_new (devices->len);
+	g_autoptr(GPtrArray) kept = g_ptr_array_new ();
+	GPtrArray *result;
+
+	for (guint i = 0; i < devices->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (devices, i);
+		g_autoptr(GError) error_local = NULL;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return NULL;
+		if (!synapticsmst_device_ensure_dpcd_identity (device, cancellable, &error_local))
+			g_debug ("not deduplicating: %s", error_local->message);
+		g_ptr_array_add (order, device);
+	}
 
-		if (nRet) {
-			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : can't write flash at offset 0x%04x\n", offset);
-		}
-		else {
-		/* check data just written */
-			checksum = 0;
-			for (guint32 i=0; i<payload_len; i++) {
-				checksum += *(payload_data + i);
+	/* the first route seen for a hub is its best one */
+	g_ptr_array_sort (order, synapticsmst_device_sort_route_cb);
+	for (guint i = 0; i < order->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (order, i);
+		gboolean duplicate = FALSE;
+
+		for (guint j = 0; j < kept->len; j++) {
+			SynapticsMSTDevice *device_kept = g_ptr_array_index (kept, j);
+			if (synapticsmst_device_is_same_hub (device, device_kept, cancellable)) {
+				g_debug ("aux node %u layer %u rad 0x%04x is another route to aux node %u layer %u rad 0x%04x",
+					 synapticsmst_device_get_aux_node (device),
+					 synapticsmst_device_get_layer (device),
+					 synapticsmst_device_get_rad (device),
+					 synapticsmst_device_get_aux_node (device_kept),
+					 synapticsmst_device_get_layer (device_kept),
+					 synapticsmst_device_get_rad (device_kept));
+				duplicate = TRUE;
+				break;
 			}
+		}
+		if (!duplicate)
+			g_ptr_array_add (kept, device);
+	}
 
-			flash_checksum = 0;
-			if (synapticsmst_device_get_flash_checksum (device, payload_len, 0, &flash_checksum, error)) {
-				if (checksum != flash_checksum) {
-					nRet = -1;
-					g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : checksum mismatch\n");
-				}
-			}
-			else {
-				nRet = -1;
+	/* keep the scan order so device indexes stay meaningful */
+	result = g_ptr_array_new_with_free_func (g_object_unref);
+	for (guint i = 0; i < devices->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (devices, i);
+		for (guint j = 0; j < kept->len; j++) {
+			if (g_ptr_array_index (kept, j) == device) {
+				g_ptr_array_add (result, g_object_ref (device));
+				break;
 			}
-
 		}
+	}
+	return result;
+}
 
-		/* disable remote control and close aux node */
-		synapticsmst_device_disable_remote_control (device, error);
-		synapticsmst_common_close_aux_node ();
+/**
+ * synapticsmst_device_write_region:
+ * @device: a #SynapticsMSTDevice instance.
+ * @region: the #SynapticsMSTDeviceRegion to update
+ * @data: a whole firmware image, or the region on its own
+ * @flags: #SynapticsMSTDeviceWriteFlags, e.g. %SYNAPTICSMST_DEVICE_WRITE_FLAG_FORCE
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: the #GError, or %NULL
+ *
+ * Updates one region of the firmware in place. The region checksum is
+ * checked first, then only the 4K flash sectors covering the region are
+ * erased and written back with the rest of their contents kept, and each
+ * is verified with a CRC computed by the hub. Sectors that already hold
+ * the region are not touched.
+ *
+ * A code region on its own carries no board ID, so it is only written
+ * with %SYNAPTICSMST_DEVICE_WRITE_FLAG_FORCE.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_write_region (SynapticsMSTDevice *device,
+				  SynapticsMSTDeviceRegion region,
+				  GBytes *data,
+				  SynapticsMSTDeviceWriteFlags flags,
+				  GCancellable *cancellable,
+				  GError **error)
+{
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	const guint8 *blob;
+	const guint8 *region_data = NULL;
+	gsize len;
+	gint offset = 0;
+	gint region_len = 0;
+	gboolean ret = TRUE;
+	synapticsmst_image_status image_status;
+	synapticsmst_flash_params params;
+	synapticsmst_flash_result result;
+	synapticsmst_flash_status status;
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (region < SYNAPTICSMST_DEVICE_REGION_LAST, FALSE);
+	g_return_val_if_fail (data != NULL, FALSE);
+
+	blob = g_bytes_get_data (data, &len);
+	synapticsmst_device_progress_start (device, SYNAPTICSMST_DEVICE_PHASE_VALIDATE, len);
+	image_status = synapticsmst_core_image_get_region ((synapticsmst_region) region, blob, MIN (len, G_MAXINT),
+							   &region_data, &offset, &region_len);
+	if (image_status != IMAGE_VALID) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to update %s : %s\n",
+			     synapticsmst_device_region_to_string (region),
+			     synapticsmst_core_image_status_to_string (image_status));
+		return FALSE;
 	}
-	else {
-		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : can't open DP Aux node %d\n", synapticsmst_device_get_aux_node (device));
+	if (region == SYNAPTICSMST_DEVICE_REGION_CODE && len == (gsize) region_len &&
+	    (flags & SYNAPTICSMST_DEVICE_WRITE_FLAG_FORCE) == 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "Failed to update code : a code region on its own has no board ID, use a whole image or force it\n");
 		return FALSE;
 	}
+	synapticsmst_device_progress_update (device, len);
 
-	if (nRet) {
+	if (!synapticsmst_device_open_session (device, TRUE, TRAFFIC_FOREGROUND, cancellable, error))
 		return FALSE;
+
+	/* a whole image must be for this board, and new configuration must
+	 * not move the device to another one */
+	if (!priv->has_boardID)
+		ret = synapticsmst_device_read_boardID (device, error);
+	if (ret && (len != (gsize) region_len || region == SYNAPTICSMST_DEVICE_REGION_CONFIG)) {
+		guint16 board_id;
+		if (len != (gsize) region_len)
+			board_id = synapticsmst_image_get_board_id (blob, len);
+		else
+			board_id = (region_data[ADDR_CUSTOMER_ID - offset] << 8) + region_data[ADDR_BOARD_ID - offset];
+		if (board_id != priv->boardID) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : board ID mismatch\n");
+			ret = FALSE;
+		}
 	}
-	else {
-		return TRUE;
+	if (ret) {
+		synapticsmst_device_flash_params_init (device, &params);
+		status = synapticsmst_core_update_region (offset, region_data, region_len, &params, &result);
+		ret = synapticsmst_device_flash_finish (device, status, &result, error);
+	}
+
+	synapticsmst_device_close_session (device, TRUE);
+	return ret;
+}
+
+gboolean
+synapticsmst_device_write_firmware (SynapticsMSTDevice *device, GBytes *fw, GError **error)
+{
+	return synapticsmst_device_write_firmware_internal (device, fw, NULL, error);
+}
+
+static void
+synapticsmst_device_write_firmware_thread_cb (GTask *task,
+					      gpointer source_object,
+					      gpointer task_data,
+					      GCancellable *cancellable)
+{
+	SynapticsMSTDevice *device = SYNAPTICSMST_DEVICE (source_object);
+	SynapticsMSTDevicePrivate *priv = GET_PRIVATE (device);
+	GBytes *fw = (GBytes *) task_data;
+	GError *error = NULL;
+	gboolean ret;
+
+	priv->progress_context = g_task_get_context (task);
+	ret = synapticsmst_device_write_firmware_internal (device, fw, cancellable, &error);
+	priv->progress_context = NULL;
+	if (!ret) {
+		g_task_return_error (task, error);
+		return;
 	}
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * synapticsmst_device_write_firmware_async:
+ * @device: a #SynapticsMSTDevice instance.
+ * @fw: the firmware image
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously validates, writes and verifies a firmware image. If
+ * @cancellable is triggered the update stops before the next remote
+ * control command is sent.
+ *
+ * Since: 0.9.1
+ **/
+void
+synapticsmst_device_write_firmware_async (SynapticsMSTDevice *device,
+					  GBytes *fw,
+					  GCancellable *cancellable,
+					  GAsyncReadyCallback callback,
+					  gpointer user_data)
+{
+	g_autoptr(GTask) task = NULL;
+
+	g_return_if_fail (SYNAPTICSMST_IS_DEVICE (device));
+	g_return_if_fail (fw != NULL);
+
+	task = g_task_new (device, cancellable, callback, user_data);
+	g_task_set_source_tag (task, synapticsmst_device_write_firmware_async);
+	g_task_set_task_data (task, g_bytes_ref (fw), (GDestroyNotify) g_bytes_unref);
+	g_task_run_in_thread (task, synapticsmst_device_write_firmware_thread_cb);
+}
+
+/**
+ * synapticsmst_device_write_firmware_finish:
+ * @device: a #SynapticsMSTDevice instance.
+ * @res: the #GAsyncResult
+ * @error: the #GError, or %NULL
+ *
+ * Gets the result from the asynchronous function.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_device_write_firmware_finish (SynapticsMSTDevice *device,
+					   GAsyncResult *res,
+					   GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (res, device), FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
 }
 
 /**
@@ -25,6 +25,7 @@
 #define __SYNAPTICSMST_DEVICE_H
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <gusb.h>
 
 G_BEGIN_DECLS
@@ -73,6 +74,136 @@ typedef enum {
 	SYNAPTICSMST_DEVICE_BOARDID_UNKNOW = 0xFFFF,
 } SynapticsMSTDeviceBoardID;
 
+/**
+ * SynapticsMSTDevicePhase:
+ * @SYNAPTICSMST_DEVICE_PHASE_VALIDATE:		Checking the firmware image
+ * @SYNAPTICSMST_DEVICE_PHASE_ERASE:		Erasing the SPI flash
+ * @SYNAPTICSMST_DEVICE_PHASE_WRITE:		Writing the firmware image
+ * @SYNAPTICSMST_DEVICE_PHASE_VERIFY:		Checking the flash checksum
+ *
+ * The firmware update phase.
+ **/
+typedef enum {
+	SYNAPTICSMST_DEVICE_PHASE_VALIDATE,
+	SYNAPTICSMST_DEVICE_PHASE_ERASE,
+	SYNAPTICSMST_DEVICE_PHASE_WRITE,
+	SYNAPTICSMST_DEVICE_PHASE_VERIFY,
+	/*< private >*/
+	SYNAPTICSMST_DEVICE_PHASE_LAST
+} SynapticsMSTDevicePhase;
+
+/**
+ * SynapticsMSTDeviceRegion:
+ * @SYNAPTICSMST_DEVICE_REGION_EDID:		The two EDID blocks at 0x000
+ * @SYNAPTICSMST_DEVICE_REGION_CONFIG:		The two configuration blocks at 0x100
+ * @SYNAPTICSMST_DEVICE_REGION_CODE:		The firmware code at 0x400
+ *
+ * A region of the firmware image that can be updated on its own.
+ **/
+typedef enum {
+	SYNAPTICSMST_DEVICE_REGION_EDID,
+	SYNAPTICSMST_DEVICE_REGION_CONFIG,
+	SYNAPTICSMST_DEVICE_REGION_CODE,
+	/*< private >*/
+	SYNAPTICSMST_DEVICE_REGION_LAST
+} SynapticsMSTDeviceRegion;
+
+/**
+ * SynapticsMSTDeviceWriteFlags:
+ * @SYNAPTICSMST_DEVICE_WRITE_FLAG_NONE:	No flags set
+ * @SYNAPTICSMST_DEVICE_WRITE_FLAG_FORCE:	Write data that can't be matched to the board
+ *
+ * Flags used when writing to the device.
+ **/
+typedef enum {
+	SYNAPTICSMST_DEVICE_WRITE_FLAG_NONE	= 0,
+	SYNAPTICSMST_DEVICE_WRITE_FLAG_FORCE	= 1 << 0,
+	/*< private >*/
+	SYNAPTICSMST_DEVICE_WRITE_FLAG_LAST
+} SynapticsMSTDeviceWriteFlags;
+
+/**
+ * SynapticsMSTDeviceProgress:
+ * @phase:		the current #SynapticsMSTDevicePhase
+ * @bytes_done:		bytes processed in this phase
+ * @bytes_total:	bytes to process in this phase
+ * @throughput:		bytes per second since the last report
+ * @throughput_avg:	bytes per second since the phase started
+ * @eta:		estimated seconds until the phase completes
+ *
+ * Progress of a firmware update.
+ **/
+typedef struct {
+	SynapticsMSTDevicePhase	 phase;
+	guint32			 bytes_done;
+	guint32			 bytes_total;
+	gdouble			 throughput;
+	gdouble			 throughput_avg;
+	gdouble			 eta;
+} SynapticsMSTDeviceProgress;
+
+/**
+ * SynapticsMSTDeviceStats:
+ * @enumerate_time:	seconds taken by the last enumerate
+ * @identity_latency:	seconds taken by the last identity read
+ * @phase_time:		seconds taken by each completed update phase
+ * @bytes_written:	bytes written to the SPI flash
+ * @rc_commands:	RC commands issued, including those of the tunnel
+ * @timeouts:		RC commands that timed out
+ * @retries:		flash blocks that had to be written again
+ * @throttle_time:	seconds spent waiting for the AUX budget
+ * @recoveries:		stuck or timed out RC commands cleared without reopening
+ *
+ * Transport statistics, accumulated since the device was created.
+ **/
+typedef struct {
+	gdouble			 enumerate_time;
+	gdouble			 identity_latency;
+	gdouble			 phase_time[SYNAPTICSMST_DEVICE_PHASE_LAST];
+	guint32			 bytes_written;
+	guint			 rc_commands;
+	guint			 timeouts;
+	guint			 retries;
+	gdouble			 throttle_time;
+	guint			 recoveries;
+} SynapticsMSTDeviceStats;
+
+/**
+ * SynapticsMSTDeviceEstimate:
+ * @bytes_total:	size of the firmware image
+ * @bytes_written:	bytes that are not blank and would be written
+ * @rc_latency:		measured seconds per RC transfer at the device layer
+ * @erase_time:		predicted seconds to erase the SPI flash
+ * @write_time:		predicted seconds to write the image
+ * @verify_time:	measured seconds to checksum the image
+ *
+ * Predicted duration of a firmware update.
+ **/
+typedef struct {
+	guint32			 bytes_total;
+	guint32			 bytes_written;
+	gdouble			 rc_latency;
+	gdouble			 erase_time;
+	gdouble			 write_time;
+	gdouble			 verify_time;
+} SynapticsMSTDeviceEstimate;
+
+/**
+ * SynapticsMSTDeviceDpcdRange:
+ * @address:		the first DPCD address
+ * @length:		the number of bytes
+ *
+ * A range of DPCD registers.
+ **/
+typedef struct {
+	guint32			 address;
+	guint32			 length;
+} SynapticsMSTDeviceDpcdRange;
+
+typedef void (*SynapticsMSTDeviceProgressFunc)	(SynapticsMSTDevice		*device,
+						 const SynapticsMSTDeviceProgress *progress,
+						 gpointer			 user_data);
+
 SynapticsMSTDevice	*synapticsmst_device_new	(SynapticsMSTDeviceKind kind, guint8 aux_node, guint8 layer, guint16 rad);
 
 /* helpers */
@@ -80,6 +211,9 @@ SynapticsMSTDeviceKind synapticsmst_device_kind_from_string	(const gchar	*kind);
 const gchar	*synapticsmst_device_kind_to_string		(SynapticsMSTDeviceKind kind);
 const gchar	*synapticsmst_device_boardID_to_string		(SynapticsMSTDeviceBoardID boardID);
 const gchar *synapticsmst_device_aux_node_to_string (guint8 index);
+const gchar	*synapticsmst_device_phase_to_string		(SynapticsMSTDevicePhase phase);
+SynapticsMSTDeviceRegion synapticsmst_device_region_from_string	(const gchar	*region);
+const gchar	*synapticsmst_device_region_to_string		(SynapticsMSTDeviceRegion region);
 gboolean synapticsmst_device_enable_remote_control (SynapticsMSTDevice *device, GError **error);
 gboolean synapticsmst_device_disable_remote_control (SynapticsMSTDevice *device, GError **error);
 gboolean synapticsmst_device_scan_cascade_device (SynapticsMSTDevice *device, guint8 tx_port);
@@ -90,15 +224,89 @@ SynapticsMSTDeviceBoardID synapticsmst_device_get_boardID (SynapticsMSTDevice *d
 guint8 synapticsmst_device_get_aux_node	(SynapticsMSTDevice	*device);
 const gchar	*synapticsmst_device_get_version	(SynapticsMSTDevice	*device);
 const gchar *synapticsmst_device_get_chipID (SynapticsMSTDevice *device);
+const gchar *synapticsmst_device_get_guid (SynapticsMSTDevice *device);
 guint16 synapticsmst_device_get_rad (SynapticsMSTDevice *device);
 guint8 synapticsmst_device_get_layer (SynapticsMSTDevice *device);
 gboolean synapticsmst_device_get_flash_checksum (SynapticsMSTDevice *device, int length, int offset, guint32 *checksum, GError **error);
+const SynapticsMSTDeviceStats *synapticsmst_device_get_stats (SynapticsMSTDevice *device);
+
+/* setters */
+void		synapticsmst_device_set_progress_func	(SynapticsMSTDevice	*device,
+							 SynapticsMSTDeviceProgressFunc func,
+							 gpointer		 user_data,
+							 GDestroyNotify		 destroy);
+void		synapticsmst_device_set_progress_interval (SynapticsMSTDevice	*device,
+							 guint			 interval);
 
 /* object methods */
 gboolean	synapticsmst_device_enumerate_device(SynapticsMSTDevice *devices, GError **error);
+gboolean	synapticsmst_device_ensure_identity	(SynapticsMSTDevice	*device,
+						 GCancellable		*cancellable,
+						 GError			**error);
 gboolean	synapticsmst_device_write_firmware	(SynapticsMSTDevice	*device,
 						 GBytes		*fw,
 						 GError		**error);
+gboolean	synapticsmst_device_write_region	(SynapticsMSTDevice	*device,
+						 SynapticsMSTDeviceRegion region,
+						 GBytes			*data,
+						 SynapticsMSTDeviceWriteFlags flags,
+						 GCancellable		*cancellable,
+						 GError			**error);
+gboolean	synapticsmst_device_write_firmware_batch (GPtrArray		*devices,
+							 GPtrArray		*firmwares,
+							 GCancellable		*cancellable,
+							 GError			**error);
+gboolean	synapticsmst_device_estimate_flash (SynapticsMSTDevice	*device,
+						 GBytes			*fw,
+						 SynapticsMSTDeviceEstimate *estimate,
+						 GCancellable		*cancellable,
+						 GError			**error);
+GPtrArray	*synapticsmst_device_read_dpcd_ranges (SynapticsMSTDevice *device,
+						 GArray			*ranges,
+						 GCancellable		*cancellable,
+						 GError			**error);
+gboolean	synapticsmst_device_audit	(SynapticsMSTDevice	*device,
+						 guint32		*checksum,
+						 GCancellable		*cancellable,
+						 GError			**error);
+gboolean	synapticsmst_device_calibrate	(SynapticsMSTDevice	*device,
+						 GCancellable		*cancellable,
+						 GError			**error);
+gboolean	synapticsmst_device_activate	(SynapticsMSTDevice	*device,
+						 GCancellable		*cancellable,
+						 GError			**error);
+void		 synapticsmst_device_sort_by_route (GPtrArray		*devices);
+void		 synapticsmst_device_set_cache_block_size (gint	 block_size);
+GPtrArray	*synapticsmst_device_dedupe	(GPtrArray		*devices,
+						 GCancellable		*cancellable,
+						 GError			**error);
+
+/* async object methods */
+void		synapticsmst_device_enumerate_device_async	(SynapticsMSTDevice	*device,
+								 GCancellable		*cancellable,
+								 GAsyncReadyCallback	 callback,
+								 gpointer		 user_data);
+gboolean	synapticsmst_device_enumerate_device_finish	(SynapticsMSTDevice	*device,
+								 GAsyncResult		*res,
+								 GError			**error);
+void		synapticsmst_device_write_firmware_async	(SynapticsMSTDevice	*device,
+								 GBytes			*fw,
+								 GCancellable		*cancellable,
+								 GAsyncReadyCallback	 callback,
+								 gpointer		 user_data);
+gboolean	synapticsmst_device_write_firmware_finish	(SynapticsMSTDevice	*device,
+								 GAsyncResult		*res,
+								 GError			**error);
+void		synapticsmst_device_get_flash_checksum_async	(SynapticsMSTDevice	*device,
+								 int			 length,
+								 int			 offset,
+								 GCancellable		*cancellable,
+								 GAsyncReadyCallback	 callback,
+								 gpointer		 user_data);
+gboolean	synapticsmst_device_get_flash_checksum_finish	(SynapticsMSTDevice	*device,
+								 GAsyncResult		*res,
+								 guint32		*checksum,
+								 GError			**error);
 
 G_END_DECLS
 
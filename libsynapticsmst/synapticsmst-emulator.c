@@ -0,0 +1,191 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <string.h>
+#include "synapticsmst-common.h"
+#include "synapticsmst-emulator.h"
+
+/* the hub side of the protocol, kept apart from synapticsmst-core.h so the
+ * emulator doesn't simply agree with whatever the flash engine assumes */
+#define EMULATOR_DPCD_SIZE      0x1000
+#define EMULATOR_EEPROM_SIZE    0x10000
+#define EMULATOR_UNIT_SIZE      32
+#define EMULATOR_SECTOR_SIZE    0x1000
+#define EMULATOR_SECTOR_ERASE   0x1000  /* plus the sector number, low byte first */
+#define EMULATOR_CHIP_ERASE     0xFFFF
+
+static char g_filename[64];
+static int g_attached = 0;
+static int g_rc_enabled = 0;
+static unsigned char g_dpcd[EMULATOR_DPCD_SIZE];
+static unsigned char g_eeprom[EMULATOR_EEPROM_SIZE];
+
+void
+synapticsmst_emulator_attach (const char *filename, const unsigned char *eeprom, int length)
+{
+    static const unsigned char identity[] = {
+        0x90, 0xCC, 0x24,       /* vendor ID */
+        0x00, 0x00, 0x00, 0x00,
+        0x53, 0x31,             /* chip ID */
+        0x00,
+        0x03, 0x0A, 0x02,       /* firmware version */
+    };
+
+    strncpy (g_filename, filename, sizeof (g_filename) - 1);
+    memset (g_dpcd, 0, sizeof (g_dpcd));
+    memcpy (g_dpcd + REG_VENDOR_ID, identity, sizeof (identity));
+    g_dpcd[REG_RC_CAP] = 0x04;
+
+    memset (g_eeprom, 0xFF, sizeof (g_eeprom));
+    if (length > EMULATOR_EEPROM_SIZE) {
+        length = EMULATOR_EEPROM_SIZE;
+    }
+    if (eeprom != NULL) {
+        memcpy (g_eeprom, eeprom, length);
+    }
+    g_rc_enabled = 0;
+    g_attached = 1;
+}
+
+void
+synapticsmst_emulator_detach (void)
+{
+    g_attached = 0;
+}
+
+int
+synapticsmst_emulator_is_attached (const char *filename)
+{
+    return g_attached && strcmp (filename, g_filename) == 0;
+}
+
+static int
+synapticsmst_emulator_in_eeprom (int offset, int length)
+{
+    return offset >= 0 && length >= 0 && length <= EMULATOR_EEPROM_SIZE - offset;
+}
+
+static void
+synapticsmst_emulator_set_result (unsigned int value)
+{
+    memcpy (g_dpcd + REG_RC_DATA, &value, 4);
+}
+
+static unsigned char
+synapticsmst_emulator_execute (int rc_cmd)
+{
+    unsigned char *data = g_dpcd + REG_RC_DATA;
+    unsigned int value = 0;
+    int erase_code;
+    int length;
+    int offset;
+
+    memcpy (&length, g_dpcd + REG_RC_LEN, 4);
+    memcpy (&offset, g_dpcd + REG_RC_OFFSET, 4);
+
+    if (rc_cmd != UPDC_ENABLE_RC && !g_rc_enabled) {
+        return UPDC_COMMAND_DISABLED;
+    }
+
+    switch (rc_cmd) {
+    case UPDC_ENABLE_RC:
+        if (length != 5 || memcmp (data, "PRIUS", 5) != 0) {
+            return UPDC_COMMAND_INVALID;
+        }
+        g_rc_enabled = 1;
+        g_dpcd[REG_RC_STATE] = 0x01;
+        return UPDC_COMMAND_SUCCESS;
+    case UPDC_DISABLE_RC:
+        g_rc_enabled = 0;
+        g_dpcd[REG_RC_STATE] = 0x00;
+        return UPDC_COMMAND_SUCCESS;
+    case UPDC_READ_FROM_EEPROM:
+        if (length > EMULATOR_UNIT_SIZE || !synapticsmst_emulator_in_eeprom (offset, length)) {
+            return UPDC_COMMAND_INVALID;
+        }
+        memcpy (data, g_eeprom + offset, length);
+        return UPDC_COMMAND_SUCCESS;
+    case UPDC_WRITE_TO_EEPROM:
+        if (length > EMULATOR_UNIT_SIZE || !synapticsmst_emulator_in_eeprom (offset, length)) {
+            return UPDC_COMMAND_INVALID;
+        }
+        /* like SPI flash, programming can only clear bits */
+        for (int i = 0; i < length; i++) {
+            g_eeprom[offset + i] &= data[i];
+        }
+        return UPDC_COMMAND_SUCCESS;
+    case UPDC_FLASH_ERASE:
+        /* the whole chip, or one 4K sector; the code comes low byte first */
+        erase_code = data[0] | (data[1] << 8);
+        if (erase_code == EMULATOR_CHIP_ERASE) {
+            memset (g_eeprom, 0xFF, sizeof (g_eeprom));
+            return UPDC_COMMAND_SUCCESS;
+        }
+        if (erase_code < EMULATOR_SECTOR_ERASE ||
+            erase_code >= EMULATOR_SECTOR_ERASE + EMULATOR_EEPROM_SIZE / EMULATOR_SECTOR_SIZE) {
+            return UPDC_COMMAND_UNSUPPORT;
+        }
+        memset (g_eeprom + (erase_code - EMULATOR_SECTOR_ERASE) * EMULATOR_SECTOR_SIZE, 0xFF, EMULATOR_SECTOR_SIZE);
+        return UPDC_COMMAND_SUCCESS;
+    case UPDC_CAL_EEPROM_CHECKSUM:
+        if (!synapticsmst_emulator_in_eeprom (offset, length)) {
+            return UPDC_COMMAND_INVALID;
+        }
+        for (int i = 0; i < length; i++) {
+            value += g_eeprom[offset + i];
+        }
+        synapticsmst_emulator_set_result (value);
+        return UPDC_COMMAND_SUCCESS;
+    default:
+        /* no downstream ports, so nothing to tunnel to; the parameters of
+         * CAL_EEPROM_CHECK_CRC16 aren't known, so it is left out rather
+         * than copied from the host side */
+        return UPDC_COMMAND_UNSUPPORT;
+    }
+}
+
+unsigned char
+synapticsmst_emulator_read (int offset, unsigned char *buf, int length)
+{
+    if (offset < 0 || length < 0 || length > EMULATOR_DPCD_SIZE - offset) {
+        return DPCD_ACCESS_FAIL;
+    }
+    memcpy (buf, g_dpcd + offset, length);
+    return DPCD_SUCCESS;
+}
+
+unsigned char
+synapticsmst_emulator_write (int offset, const unsigned char *buf, int length)
+{
+    if (offset < 0 || length < 0 || length > EMULATOR_DPCD_SIZE - offset) {
+        return DPCD_ACCESS_FAIL;
+    }
+    memcpy (g_dpcd + offset, buf, length);
+
+    /* commands complete immediately, latency comes from fault injection */
+    if (offset <= REG_RC_CMD && offset + length > REG_RC_CMD && (g_dpcd[REG_RC_CMD] & 0x80)) {
+        g_dpcd[REG_RC_RESULT] = synapticsmst_emulator_execute (g_dpcd[REG_RC_CMD] & 0x7F);
+        g_dpcd[REG_RC_CMD] &= 0x7F;
+    }
+    return DPCD_SUCCESS;
+}
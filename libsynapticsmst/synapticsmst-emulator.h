@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __SYNAPTICSMST_EMULATOR_H
+#define __SYNAPTICSMST_EMULATOR_H
+
+/* an in-memory directly attached hub, for exercising the transport without
+ * hardware; only the RC commands used by the library are implemented */
+
+void
+synapticsmst_emulator_attach(const char *filename, const unsigned char *eeprom, int length);
+
+void
+synapticsmst_emulator_detach(void);
+
+int
+synapticsmst_emulator_is_attached(const char *filename);
+
+unsigned char
+synapticsmst_emulator_read(int offset, unsigned char *buf, int length);
+
+unsigned char
+synapticsmst_emulator_write(int offset, const unsigned char *buf, int length);
+
+#endif /* __SYNAPTICSMST_EMULATOR_H */
@@ -0,0 +1,162 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* a minimal flasher for early boot, linked statically against the core and
+ * without GLib; use synapticsmst-tool everywhere else */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "synapticsmst-common.h"
+#include "synapticsmst-core.h"
+
+static void
+synapticsmst_flash_usage (const char *argv0)
+{
+    fprintf (stderr, "Usage: %s AUX-NODE FILE [LAYER RAD]\n", argv0);
+}
+
+static void
+synapticsmst_flash_progress_cb (synapticsmst_flash_phase phase, unsigned int done, unsigned int total, void *user_data)
+{
+    const char *names[] = { NULL, "erase", "write", "verify" };
+
+    if (done == total) {
+        fprintf (stderr, "%s: done\n", names[phase]);
+    }
+}
+
+static int
+synapticsmst_flash_read_file (const char *filename, unsigned char *buf, int size)
+{
+    FILE *file;
+    int length;
+
+    file = fopen (filename, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    length = fread (buf, 1, size, file);
+    if (ferror (file)) {
+        length = -1;
+    }
+    fclose (file);
+    return length;
+}
+
+int
+main (int argc, char *argv[])
+{
+    static unsigned char image[IMAGE_MAX_SIZE + 1];
+    synapticsmst_flash_params params = { 0 };
+    synapticsmst_flash_result result;
+    synapticsmst_flash_status status;
+    synapticsmst_image_status image_status;
+    unsigned char layer = 0;
+    unsigned int rad = 0;
+    unsigned short board_id = 0xFFFF;
+    unsigned char nRet;
+    int length;
+    int fd;
+
+    if (argc != 3 && argc != 5) {
+        synapticsmst_flash_usage (argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 5) {
+        layer = strtoul (argv[3], NULL, 0);
+        rad = strtoul (argv[4], NULL, 0);
+    }
+
+    /* check the image before touching the hub */
+    length = synapticsmst_flash_read_file (argv[2], image, sizeof (image));
+    if (length < 0) {
+        fprintf (stderr, "Failed to read %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    image_status = synapticsmst_core_image_validate (image, length);
+    if (image_status != IMAGE_VALID) {
+        fprintf (stderr, "Failed to flash firmware : %s\n", synapticsmst_core_image_status_to_string (image_status));
+        return EXIT_FAILURE;
+    }
+
+    fd = synapticsmst_common_open_aux_node (argv[1]);
+    if (fd == -2) {
+        fprintf (stderr, "DP Aux Node is in use by another process\n");
+        return EXIT_FAILURE;
+    }
+    if (fd <= 0) {
+        fprintf (stderr, "No Synaptics MST hub in %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    synapticsmst_common_config_connection (layer, rad);
+    nRet = synapticsmst_common_enable_remote_control ();
+    if (nRet) {
+        fprintf (stderr, "Failed to enable MST remote control\n");
+        synapticsmst_common_close_aux_node ();
+        return EXIT_FAILURE;
+    }
+
+    status = FLASH_SUCCESS;
+    nRet = synapticsmst_core_read_board_id (NULL, &board_id);
+    if (nRet) {
+        fprintf (stderr, "Failed to read from EEPROM of device\n");
+    }
+    else if (board_id != synapticsmst_core_image_get_board_id (image, length)) {
+        fprintf (stderr, "Failed to flash firmware : board ID mismatch\n");
+        nRet = 1;
+    }
+    else {
+        params.write_retries = 1;
+        params.progress_func = synapticsmst_flash_progress_cb;
+        status = synapticsmst_core_flash (image, length, &params, &result);
+        switch (status) {
+        case FLASH_SUCCESS:
+            fprintf (stderr, "Wrote %u bytes, %u retries\n", result.bytes_written, result.retries);
+            break;
+        case FLASH_ERASE_FAIL:
+            fprintf (stderr, "Failed to flash firmware : can't erase flash\n");
+            break;
+        case FLASH_WRITE_FAIL:
+            fprintf (stderr, "Failed to flash firmware : can't write flash at offset 0x%04x\n", result.offset);
+            break;
+        case FLASH_READ_FAIL:
+            fprintf (stderr, "Failed to flash firmware : can't read flash at offset 0x%04x\n", result.offset);
+            break;
+        case FLASH_CHECKSUM_FAIL:
+            fprintf (stderr, "Failed to get flash checksum\n");
+            break;
+        case FLASH_CHECKSUM_MISMATCH:
+            fprintf (stderr, "Failed to flash firmware : checksum mismatch\n");
+            break;
+        }
+    }
+
+    synapticsmst_common_config_connection (layer, rad);
+    synapticsmst_common_disable_remote_control ();
+    synapticsmst_common_close_aux_node ();
+    return (nRet || status != FLASH_SUCCESS) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
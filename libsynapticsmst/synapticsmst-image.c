@@ -0,0 +1,98 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "synapticsmst-core.h"
+#include "synapticsmst-image.h"
+
+guint16
+synapticsmst_image_get_board_id (const guint8 *data, gsize len)
+{
+	return synapticsmst_core_image_get_board_id (data, MIN (len, G_MAXINT));
+}
+
+gboolean
+synapticsmst_image_validate (const guint8 *data, gsize len, GError **error)
+{
+	synapticsmst_image_status status;
+
+	status = synapticsmst_core_image_validate (data, MIN (len, G_MAXINT));
+	if (status != IMAGE_VALID) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s\n",
+			     synapticsmst_core_image_status_to_string (status));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+guint16
+synapticsmst_image_crc16 (guint16 crc, const guint8 *data, gsize len)
+{
+	return synapticsmst_core_image_crc16 (crc, data, len);
+}
+
+guint32
+synapticsmst_image_checksum (const guint8 *data, gsize len)
+{
+	return synapticsmst_core_image_checksum (data, len);
+}
+
+SynapticsMSTImagePlan *
+synapticsmst_image_plan_new (const guint8 *data, guint32 len, guint32 block_size)
+{
+	SynapticsMSTImagePlan *plan = g_new0 (SynapticsMSTImagePlan, 1);
+
+	plan->size = len;
+	plan->block_size = block_size;
+	plan->n_blocks = (len + block_size - 1) / block_size;
+	plan->checksum = synapticsmst_image_checksum (data, len);
+	plan->block_blank = g_new0 (gboolean, plan->n_blocks);
+
+	for (guint i = 0; i < plan->n_blocks; i++) {
+		guint32 offset = i * block_size;
+		guint32 length = MIN (block_size, len - offset);
+		gboolean blank = TRUE;
+
+		/* erased flash already reads back as 0xFF */
+		for (guint32 j = 0; j < length; j++) {
+			if (data[offset + j] != 0xFF) {
+				blank = FALSE;
+				break;
+			}
+		}
+		plan->block_blank[i] = blank;
+		if (blank)
+			plan->n_blank++;
+	}
+	return plan;
+}
+
+void
+synapticsmst_image_plan_free (SynapticsMSTImagePlan *plan)
+{
+	g_free (plan->block_blank);
+	g_free (plan);
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __SYNAPTICSMST_IMAGE_H
+#define __SYNAPTICSMST_IMAGE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define SYNAPTICSMST_IMAGE_MAX_SIZE	0x10000
+#define SYNAPTICSMST_IMAGE_CODE_OFFSET	0x400
+
+typedef struct {
+	guint32		 size;
+	guint32		 block_size;
+	guint		 n_blocks;
+	guint		 n_blank;
+	guint32		 checksum;
+	gboolean	*block_blank;
+} SynapticsMSTImagePlan;
+
+guint16		 synapticsmst_image_get_board_id	(const guint8	*data,
+							 gsize		 len);
+gboolean	 synapticsmst_image_validate		(const guint8	*data,
+							 gsize		 len,
+							 GError		**error);
+guint16		 synapticsmst_image_crc16		(guint16	 crc,
+							 const guint8	*data,
+							 gsize		 len);
+guint32		 synapticsmst_image_checksum		(const guint8	*data,
+							 gsize		 len);
+
+SynapticsMSTImagePlan *synapticsmst_image_plan_new	(const guint8	*data,
+							 guint32	 len,
+							 guint32	 block_size);
+void		 synapticsmst_image_plan_free		(SynapticsMSTImagePlan *plan);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SynapticsMSTImagePlan, synapticsmst_image_plan_free)
+
+G_END_DECLS
+
+#endif /* __SYNAPTICSMST_IMAGE_H */
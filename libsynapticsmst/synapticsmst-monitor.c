@@ -0,0 +1,471 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:synapticsmst-monitor
+ * @short_description: Hotplug monitor for Synaptics MST devices
+ *
+ * This object watches the DRM connectors and DP Aux nodes and only
+ * re-enumerates the aux node that changed, keeping the existing
+ * #SynapticsMSTDevice objects for hubs that are still present.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <gudev/gudev.h>
+
+#include "synapticsmst-monitor.h"
+#include "synapticsmst-common.h"
+
+#define SYNAPTICSMST_MONITOR_COALESCE_MS	100	/* ms */
+
+typedef struct
+{
+	GUdevClient		*udev_client;
+	GPtrArray		*devices[MAX_DP_AUX_NODES];
+	guint			 pending_aux_nodes;	/* bitmask */
+	guint			 pending_id;
+} SynapticsMSTMonitorPrivate;
+
+enum {
+	SIGNAL_DEVICE_ADDED,
+	SIGNAL_DEVICE_REMOVED,
+	SIGNAL_DEVICE_CHANGED,
+	SIGNAL_LAST
+};
+
+static guint signals[SIGNAL_LAST] = { 0 };
+
+G_DEFINE_TYPE_WITH_PRIVATE (SynapticsMSTMonitor, synapticsmst_monitor, G_TYPE_OBJECT)
+
+#define GET_PRIVATE(o) (synapticsmst_monitor_get_instance_private (o))
+
+static SynapticsMSTDevice *
+synapticsmst_monitor_find_device (GPtrArray *devices, guint8 layer, guint16 rad)
+{
+	if (devices == NULL)
+		return NULL;
+	for (guint i = 0; i < devices->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (devices, i);
+		if (synapticsmst_device_get_layer (device) == layer &&
+		    synapticsmst_device_get_rad (device) == rad)
+			return device;
+	}
+	return NULL;
+}
+
+static GPtrArray *
+synapticsmst_monitor_scan_aux_node (guint8 aux_node, GError **error)
+{
+	SynapticsMSTDevice *device;
+	const gchar *aux_node_path = synapticsmst_device_aux_node_to_string (aux_node);
+	g_autoptr(GPtrArray) devices = g_ptr_array_new_with_free_func (g_object_unref);
+	gint fd;
+
+	/* an aux node goes away with its dock, which just means no devices */
+	fd = synapticsmst_common_open_aux_node (aux_node_path);
+	if (fd == -1 && (errno == ENOENT || errno == ENODEV))
+		return g_steal_pointer (&devices);
+	if (fd == -1) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to open aux node %d, please try sudo to get permission\n", aux_node);
+		return NULL;
+	}
+	if (fd == -2) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY, "Aux node %d is in use by another process\n", aux_node);
+		return NULL;
+	}
+	if (fd == 0)
+		return g_steal_pointer (&devices);
+
+	/* walk the cascade behind this aux node only */
+	device = synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_DIRECT, aux_node, 0, 0);
+	g_ptr_array_add (devices, device);
+	for (guint i = 0; i < devices->len; i++) {
+		device = g_ptr_array_index (devices, i);
+		if (!synapticsmst_device_enable_remote_control (device, error)) {
+			synapticsmst_common_close_aux_node ();
+			return NULL;
+		}
+		for (guint8 j = 0; j < 2; j++) {
+			guint8 layer;
+			guint16 rad;
+			if (!synapticsmst_device_scan_cascade_device (device, j))
+				continue;
+			layer = synapticsmst_device_get_layer (device) + 1;
+			rad = synapticsmst_device_get_rad (device) | (j << (2 * (layer - 1)));
+			g_ptr_array_add (devices, synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_REMOTE, aux_node, layer, rad));
+		}
+		synapticsmst_device_disable_remote_control (device, NULL);
+	}
+	synapticsmst_common_close_aux_node ();
+
+	return g_steal_pointer (&devices);
+}
+
+/**
+ * synapticsmst_monitor_rescan_aux_node:
+ * @monitor: a #SynapticsMSTMonitor instance.
+ * @aux_node: the DP Aux node index
+ * @error: the #GError, or %NULL
+ *
+ * Re-enumerates the devices behind one DP Aux node, emitting
+ * ::device-added, ::device-removed and ::device-changed as required.
+ * Devices on other aux nodes are not touched.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_monitor_rescan_aux_node (SynapticsMSTMonitor *monitor, guint8 aux_node, GError **error)
+{
+	SynapticsMSTMonitorPrivate *priv = GET_PRIVATE (monitor);
+	GPtrArray *old = priv->devices[aux_node];
+	g_autoptr(GPtrArray) found = NULL;
+	g_autoptr(GPtrArray) devices = NULL;
+	g_autoptr(GPtrArray) added = g_ptr_array_new ();
+	g_autoptr(GPtrArray) changed = g_ptr_array_new ();
+	g_autoptr(GPtrArray) removed = g_ptr_array_new ();
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_MONITOR (monitor), FALSE);
+	g_return_val_if_fail (aux_node < MAX_DP_AUX_NODES, FALSE);
+
+	found = synapticsmst_monitor_scan_aux_node (aux_node, error);
+	if (found == NULL)
+		return FALSE;
+
+	/* keep the objects we already know about */
+	devices = g_ptr_array_new_with_free_func (g_object_unref);
+	for (guint i = 0; i < found->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (found, i);
+		SynapticsMSTDevice *device_old;
+		g_autofree gchar *version = NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		device_old = synapticsmst_monitor_find_device (old,
+							       synapticsmst_device_get_layer (device),
+							       synapticsmst_device_get_rad (device));
+		if (device_old == NULL) {
+			if (!synapticsmst_device_enumerate_device (device, &error_local)) {
+				g_debug ("ignoring device: %s", error_local->message);
+				continue;
+			}
+			g_ptr_array_add (devices, g_object_ref (device));
+			g_ptr_array_add (added, device);
+			continue;
+		}
+
+		version = g_strdup (synapticsmst_device_get_version (device_old));
+		if (!synapticsmst_device_enumerate_device (device_old, &error_local)) {
+			g_debug ("ignoring device: %s", error_local->message);
+			continue;
+		}
+		g_ptr_array_add (devices, g_object_ref (device_old));
+		if (g_strcmp0 (version, synapticsmst_device_get_version (device_old)) != 0)
+			g_ptr_array_add (changed, device_old);
+	}
+	if (old != NULL) {
+		for (guint i = 0; i < old->len; i++) {
+			SynapticsMSTDevice *device_old = g_ptr_array_index (old, i);
+			if (synapticsmst_monitor_find_device (devices,
+							      synapticsmst_device_get_layer (device_old),
+							      synapticsmst_device_get_rad (device_old)) == NULL)
+				g_ptr_array_add (removed, g_object_ref (device_old));
+		}
+	}
+
+	/* swap in the new list before telling anyone */
+	priv->devices[aux_node] = g_steal_pointer (&devices);
+	if (old != NULL)
+		g_ptr_array_unref (old);
+
+	for (guint i = 0; i < removed->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (removed, i);
+		g_signal_emit (monitor, signals[SIGNAL_DEVICE_REMOVED], 0, device);
+		g_object_unref (device);
+	}
+	for (guint i = 0; i < added->len; i++)
+		g_signal_emit (monitor, signals[SIGNAL_DEVICE_ADDED], 0, g_ptr_array_index (added, i));
+	for (guint i = 0; i < changed->len; i++)
+		g_signal_emit (monitor, signals[SIGNAL_DEVICE_CHANGED], 0, g_ptr_array_index (changed, i));
+	return TRUE;
+}
+
+/**
+ * synapticsmst_monitor_coldplug:
+ * @monitor: a #SynapticsMSTMonitor instance.
+ * @error: the #GError, or %NULL
+ *
+ * Enumerates every DP Aux node, emitting ::device-added for each device.
+ * An aux node that can't be scanned is skipped, so the others still are.
+ *
+ * Returns: %TRUE if at least one aux node was scanned
+ *
+ * Since: 0.9.1
+ **/
+gboolean
+synapticsmst_monitor_coldplug (SynapticsMSTMonitor *monitor, GError **error)
+{
+	g_autoptr(GError) error_first = NULL;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_MONITOR (monitor), FALSE);
+
+	for (guint8 i = 0; i < MAX_DP_AUX_NODES; i++) {
+		g_autoptr(GError) error_local = NULL;
+
+		if (synapticsmst_monitor_rescan_aux_node (monitor, i, &error_local)) {
+			ret = TRUE;
+			continue;
+		}
+		g_warning ("failed to scan aux node %d: %s", i, error_local->message);
+		if (error_first == NULL)
+			error_first = g_steal_pointer (&error_local);
+	}
+	if (!ret) {
+		g_propagate_error (error, g_steal_pointer (&error_first));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * synapticsmst_monitor_get_devices:
+ * @monitor: a #SynapticsMSTMonitor instance.
+ *
+ * Gets all the devices currently known to the monitor.
+ *
+ * Returns: (transfer container) (element-type SynapticsMSTDevice): devices
+ *
+ * Since: 0.9.1
+ **/
+GPtrArray *
+synapticsmst_monitor_get_devices (SynapticsMSTMonitor *monitor)
+{
+	SynapticsMSTMonitorPrivate *priv = GET_PRIVATE (monitor);
+	GPtrArray *devices = g_ptr_array_new_with_free_func (g_object_unref);
+
+	g_return_val_if_fail (SYNAPTICSMST_IS_MONITOR (monitor), NULL);
+
+	for (guint8 i = 0; i < MAX_DP_AUX_NODES; i++) {
+		if (priv->devices[i] == NULL)
+			continue;
+		for (guint j = 0; j < priv->devices[i]->len; j++)
+			g_ptr_array_add (devices, g_object_ref (g_ptr_array_index (priv->devices[i], j)));
+	}
+	return devices;
+}
+
+static gboolean
+synapticsmst_monitor_pending_cb (gpointer user_data)
+{
+	SynapticsMSTMonitor *monitor = SYNAPTICSMST_MONITOR (user_data);
+	SynapticsMSTMonitorPrivate *priv = GET_PRIVATE (monitor);
+	guint pending = priv->pending_aux_nodes;
+
+	priv->pending_aux_nodes = 0;
+	priv->pending_id = 0;
+	for (guint8 i = 0; i < MAX_DP_AUX_NODES; i++) {
+		g_autoptr(GError) error = NULL;
+		if ((pending & (1 << i)) == 0)
+			continue;
+		if (!synapticsmst_monitor_rescan_aux_node (monitor, i, &error))
+			g_warning ("failed to rescan aux node %d: %s", i, error->message);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void
+synapticsmst_monitor_queue_aux_node (SynapticsMSTMonitor *monitor, guint8 aux_node)
+{
+	SynapticsMSTMonitorPrivate *priv = GET_PRIVATE (monitor);
+
+	if (aux_node >= MAX_DP_AUX_NODES)
+		return;
+
+	/* a single dock plug produces a burst of events, coalesce them */
+	priv->pending_aux_nodes |= 1 << aux_node;
+	if (priv->pending_id == 0) {
+		priv->pending_id = g_timeout_add (SYNAPTICSMST_MONITOR_COALESCE_MS,
+						  synapticsmst_monitor_pending_cb,
+						  monitor);
+	}
+}
+
+static gboolean
+synapticsmst_monitor_aux_matches_event (GUdevDevice *aux, GUdevDevice *udev_device)
+{
+	const gchar *aux_path = g_udev_device_get_sysfs_path (aux);
+	const gchar *card_path = g_udev_device_get_sysfs_path (udev_device);
+	const gchar *connector_id;
+	const gchar *aux_connector_id;
+	g_autoptr(GUdevDevice) connector = NULL;
+
+	/* the aux node is a child of the connector, which is a child of the
+	 * card; card1 must not match the devices of card10 */
+	if (aux_path == NULL || card_path == NULL ||
+	    !g_str_has_prefix (aux_path, card_path) ||
+	    aux_path[strlen (card_path)] != '/')
+		return FALSE;
+
+	/* hotplug events on the card say which connector changed, but older
+	 * kernels don't export the ID of the connector to compare it with */
+	connector_id = g_udev_device_get_property (udev_device, "CONNECTOR");
+	if (connector_id == NULL)
+		return TRUE;
+	connector = g_udev_device_get_parent (aux);
+	if (connector == NULL)
+		return TRUE;
+	aux_connector_id = g_udev_device_get_sysfs_attr (connector, "connector_id");
+	if (aux_connector_id == NULL)
+		return TRUE;
+	return g_strcmp0 (aux_connector_id, connector_id) == 0;
+}
+
+static void
+synapticsmst_monitor_uevent_cb (GUdevClient *client,
+				const gchar *action,
+				GUdevDevice *udev_device,
+				SynapticsMSTMonitor *monitor)
+{
+	const gchar *subsystem = g_udev_device_get_subsystem (udev_device);
+	GList *auxs;
+
+	g_debug ("%s uevent for %s", action, g_udev_device_get_sysfs_path (udev_device));
+
+	/* the aux node itself came or went */
+	if (g_strcmp0 (subsystem, "drm_dp_aux_dev") == 0) {
+		const gchar *number = g_udev_device_get_number (udev_device);
+		if (number != NULL)
+			synapticsmst_monitor_queue_aux_node (monitor, g_ascii_strtoull (number, NULL, 10));
+		return;
+	}
+
+	/* a connector changed, so only rescan the aux nodes below it */
+	auxs = g_udev_client_query_by_subsystem (client, "drm_dp_aux_dev");
+	for (GList *l = auxs; l != NULL; l = l->next) {
+		GUdevDevice *aux = l->data;
+		const gchar *number = g_udev_device_get_number (aux);
+		if (number == NULL)
+			continue;
+		if (!synapticsmst_monitor_aux_matches_event (aux, udev_device))
+			continue;
+		synapticsmst_monitor_queue_aux_node (monitor, g_ascii_strtoull (number, NULL, 10));
+	}
+	g_list_free_full (auxs, g_object_unref);
+}
+
+static void
+synapticsmst_monitor_finalize (GObject *object)
+{
+	SynapticsMSTMonitor *monitor = SYNAPTICSMST_MONITOR (object);
+	SynapticsMSTMonitorPrivate *priv = GET_PRIVATE (monitor);
+
+	if (priv->pending_id != 0)
+		g_source_remove (priv->pending_id);
+	for (guint8 i = 0; i < MAX_DP_AUX_NODES; i++) {
+		if (priv->devices[i] != NULL)
+			g_ptr_array_unref (priv->devices[i]);
+	}
+	g_object_unref (priv->udev_client);
+	G_OBJECT_CLASS (synapticsmst_monitor_parent_class)->finalize (object);
+}
+
+static void
+synapticsmst_monitor_init (SynapticsMSTMonitor *monitor)
+{
+	SynapticsMSTMonitorPrivate *priv = GET_PRIVATE (monitor);
+	const gchar *subsystems[] = { "drm", "drm_dp_aux_dev", NULL };
+
+	priv->udev_client = g_udev_client_new (subsystems);
+	g_signal_connect (priv->udev_client, "uevent",
+			  G_CALLBACK (synapticsmst_monitor_uevent_cb), monitor);
+}
+
+static void
+synapticsmst_monitor_class_init (SynapticsMSTMonitorClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = synapticsmst_monitor_finalize;
+
+	/**
+	 * SynapticsMSTMonitor::device-added:
+	 * @monitor: the #SynapticsMSTMonitor instance that emitted the signal
+	 * @device: the #SynapticsMSTDevice
+	 *
+	 * The ::device-added signal is emitted when a new device is found.
+	 **/
+	signals[SIGNAL_DEVICE_ADDED] =
+		g_signal_new ("device-added",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (SynapticsMSTMonitorClass, device_added),
+			      NULL, NULL, g_cclosure_marshal_VOID__OBJECT,
+			      G_TYPE_NONE, 1, SYNAPTICSMST_TYPE_DEVICE);
+
+	/**
+	 * SynapticsMSTMonitor::device-removed:
+	 * @monitor: the #SynapticsMSTMonitor instance that emitted the signal
+	 * @device: the #SynapticsMSTDevice
+	 *
+	 * The ::device-removed signal is emitted when a device goes away.
+	 **/
+	signals[SIGNAL_DEVICE_REMOVED] =
+		g_signal_new ("device-removed",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (SynapticsMSTMonitorClass, device_removed),
+			      NULL, NULL, g_cclosure_marshal_VOID__OBJECT,
+			      G_TYPE_NONE, 1, SYNAPTICSMST_TYPE_DEVICE);
+
+	/**
+	 * SynapticsMSTMonitor::device-changed:
+	 * @monitor: the #SynapticsMSTMonitor instance that emitted the signal
+	 * @device: the #SynapticsMSTDevice
+	 *
+	 * The ::device-changed signal is emitted when a known device reports
+	 * a different firmware version.
+	 **/
+	signals[SIGNAL_DEVICE_CHANGED] =
+		g_signal_new ("device-changed",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (SynapticsMSTMonitorClass, device_changed),
+			      NULL, NULL, g_cclosure_marshal_VOID__OBJECT,
+			      G_TYPE_NONE, 1, SYNAPTICSMST_TYPE_DEVICE);
+}
+
+/**
+ * synapticsmst_monitor_new:
+ *
+ * Creates a new #SynapticsMSTMonitor.
+ *
+ * Returns: (transfer full): a #SynapticsMSTMonitor
+ *
+ * Since: 0.9.1
+ **/
+SynapticsMSTMonitor *
+synapticsmst_monitor_new (void)
+{
+	SynapticsMSTMonitor *monitor;
+	monitor = g_object_new (SYNAPTICSMST_TYPE_MONITOR, NULL);
+	return SYNAPTICSMST_MONITOR (monitor);
+}
@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __SYNAPTICSMST_MONITOR_H
+#define __SYNAPTICSMST_MONITOR_H
+
+#include <glib-object.h>
+
+#include "synapticsmst-device.h"
+
+G_BEGIN_DECLS
+
+#define SYNAPTICSMST_TYPE_MONITOR (synapticsmst_monitor_get_type ())
+G_DECLARE_DERIVABLE_TYPE (SynapticsMSTMonitor, synapticsmst_monitor, SYNAPTICSMST, MONITOR, GObject)
+
+struct _SynapticsMSTMonitorClass
+{
+	GObjectClass		parent_class;
+	void			(*device_added)		(SynapticsMSTMonitor	*monitor,
+							 SynapticsMSTDevice	*device);
+	void			(*device_removed)	(SynapticsMSTMonitor	*monitor,
+							 SynapticsMSTDevice	*device);
+	void			(*device_changed)	(SynapticsMSTMonitor	*monitor,
+							 SynapticsMSTDevice	*device);
+	/*< private >*/
+	void (*_as_reserved1)	(void);
+	void (*_as_reserved2)	(void);
+	void (*_as_reserved3)	(void);
+	void (*_as_reserved4)	(void);
+	void (*_as_reserved5)	(void);
+};
+
+SynapticsMSTMonitor	*synapticsmst_monitor_new		(void);
+
+/* object methods */
+gboolean	 synapticsmst_monitor_coldplug			(SynapticsMSTMonitor	*monitor,
+								 GError			**error);
+gboolean	 synapticsmst_monitor_rescan_aux_node		(SynapticsMSTMonitor	*monitor,
+								 guint8			 aux_node,
+								 GError			**error);
+GPtrArray	*synapticsmst_monitor_get_devices		(SynapticsMSTMonitor	*monitor);
+
+G_END_DECLS
+
+#endif /* __SYNAPTICSMST_MONITOR_H */
@@ -0,0 +1,172 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "synapticsmst-common.h"
+#include "synapticsmst-profile.h"
+
+#define PROFILE_UNIT_SIZE	32
+#define PROFILE_MAX_WAIT_TIME	3000	/* ms */
+#define PROFILE_POLL_INTERVAL	500	/* us */
+#define PROFILE_BLOCK_UNIT	64
+#define PROFILE_WRITE_RETRIES	1
+
+/**
+ * synapticsmst_profile_get_filename:
+ *
+ * Gets the file the calibrated profiles are kept in, which can be
+ * overridden with the SYNAPTICSMST_PROFILE_FILE environment variable.
+ *
+ * Returns: a filename
+ **/
+const gchar *
+synapticsmst_profile_get_filename (void)
+{
+	const gchar *tmp = g_getenv ("SYNAPTICSMST_PROFILE_FILE");
+	if (tmp != NULL)
+		return tmp;
+	return LOCALSTATEDIR "/lib/synapticsmst/profiles.conf";
+}
+
+static gchar *
+synapticsmst_profile_get_group (guint16 board_id)
+{
+	return g_strdup_printf ("0x%04x", board_id);
+}
+
+/**
+ * synapticsmst_profile_init:
+ * @profile: a #SynapticsMSTProfile
+ *
+ * Sets the conservative defaults that work on every board.
+ **/
+void
+synapticsmst_profile_init (SynapticsMSTProfile *profile)
+{
+	profile->unit_size = PROFILE_UNIT_SIZE;
+	profile->max_wait_time = PROFILE_MAX_WAIT_TIME;
+	profile->poll_interval = PROFILE_POLL_INTERVAL;
+	profile->block_unit = PROFILE_BLOCK_UNIT;
+	profile->write_retries = PROFILE_WRITE_RETRIES;
+	profile->throughput = 0.f;
+}
+
+static guint
+synapticsmst_profile_get_uint (GKeyFile *kf, const gchar *group, const gchar *key, guint min, guint max, guint fallback)
+{
+	g_autoptr(GError) error = NULL;
+	gint value = g_key_file_get_integer (kf, group, key, &error);
+	if (error != NULL || value < (gint) min || value > (gint) max)
+		return fallback;
+	return value;
+}
+
+/**
+ * synapticsmst_profile_load:
+ * @profile: a #SynapticsMSTProfile
+ * @board_id: the board ID
+ * @error: a #GError or %NULL
+ *
+ * Loads the calibrated profile for a board. @profile is set to the
+ * defaults first, so it is usable even if this fails.
+ *
+ * Returns: %TRUE if a profile was found for @board_id
+ **/
+gboolean
+synapticsmst_profile_load (SynapticsMSTProfile *profile, guint16 board_id, GError **error)
+{
+	g_autoptr(GKeyFile) kf = g_key_file_new ();
+	g_autofree gchar *group = synapticsmst_profile_get_group (board_id);
+
+	synapticsmst_profile_init (profile);
+	if (!g_key_file_load_from_file (kf, synapticsmst_profile_get_filename (), G_KEY_FILE_NONE, error))
+		return FALSE;
+	if (!g_key_file_has_group (kf, group)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No profile for board ID 0x%04x\n", board_id);
+		return FALSE;
+	}
+
+	/* ignore anything out of range rather than trusting a hand edit */
+	profile->unit_size = synapticsmst_profile_get_uint (kf, group, "UnitSize", 1, PROFILE_UNIT_SIZE, PROFILE_UNIT_SIZE);
+	profile->max_wait_time = synapticsmst_profile_get_uint (kf, group, "MaxWaitTime", PROFILE_MAX_WAIT_TIME, 60000, PROFILE_MAX_WAIT_TIME);
+	profile->poll_interval = synapticsmst_profile_get_uint (kf, group, "PollInterval", 1, 100000, PROFILE_POLL_INTERVAL);
+	profile->block_unit = synapticsmst_profile_get_uint (kf, group, "BlockUnit", 1, 0x1000, PROFILE_BLOCK_UNIT);
+	profile->write_retries = synapticsmst_profile_get_uint (kf, group, "WriteRetries", 0, 10, PROFILE_WRITE_RETRIES);
+	profile->throughput = g_key_file_get_double (kf, group, "Throughput", NULL);
+	return TRUE;
+}
+
+/**
+ * synapticsmst_profile_save:
+ * @profile: a #SynapticsMSTProfile
+ * @board_id: the board ID
+ * @error: a #GError or %NULL
+ *
+ * Saves the profile for a board, keeping the profiles of other boards.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+synapticsmst_profile_save (const SynapticsMSTProfile *profile, guint16 board_id, GError **error)
+{
+	const gchar *filename = synapticsmst_profile_get_filename ();
+	g_autoptr(GKeyFile) kf = g_key_file_new ();
+	g_autofree gchar *dirname = g_path_get_dirname (filename);
+	g_autofree gchar *group = synapticsmst_profile_get_group (board_id);
+
+	/* a missing or corrupt file is simply replaced */
+	g_key_file_load_from_file (kf, filename, G_KEY_FILE_KEEP_COMMENTS, NULL);
+	g_key_file_set_integer (kf, group, "UnitSize", profile->unit_size);
+	g_key_file_set_integer (kf, group, "MaxWaitTime", profile->max_wait_time);
+	g_key_file_set_integer (kf, group, "PollInterval", profile->poll_interval);
+	g_key_file_set_integer (kf, group, "BlockUnit", profile->block_unit);
+	g_key_file_set_integer (kf, group, "WriteRetries", profile->write_retries);
+	g_key_file_set_double (kf, group, "Throughput", profile->throughput);
+
+	if (g_mkdir_with_parents (dirname, 0755) != 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create %s\n", dirname);
+		return FALSE;
+	}
+	return g_key_file_save_to_file (kf, filename, error);
+}
+
+/**
+ * synapticsmst_profile_apply:
+ * @profile: a #SynapticsMSTProfile
+ *
+ * Uses the transport settings of @profile for the open aux node. They
+ * are reset to the defaults when the aux node is closed.
+ **/
+void
+synapticsmst_profile_apply (const SynapticsMSTProfile *profile)
+{
+	synapticsmst_transport transport = { 0 };
+
+	transport.unit_size = profile->unit_size;
+	transport.max_wait_time = profile->max_wait_time;
+	transport.poll_interval = profile->poll_interval;
+	synapticsmst_common_set_transport (&transport);
+}
@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __SYNAPTICSMST_PROFILE_H
+#define __SYNAPTICSMST_PROFILE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	guint		 unit_size;		/* bytes per RC transfer */
+	guint		 max_wait_time;		/* ms per RC command */
+	guint		 poll_interval;		/* us between RC_CMD polls */
+	guint		 block_unit;		/* bytes per flash write block */
+	guint		 write_retries;		/* extra attempts for a bad block */
+	gdouble		 throughput;		/* bytes/s measured when calibrated */
+} SynapticsMSTProfile;
+
+const gchar	*synapticsmst_profile_get_filename	(void);
+void		 synapticsmst_profile_init		(SynapticsMSTProfile		*profile);
+gboolean	 synapticsmst_profile_load		(SynapticsMSTProfile		*profile,
+							 guint16			 board_id,
+							 GError				**error);
+gboolean	 synapticsmst_profile_save		(const SynapticsMSTProfile	*profile,
+							 guint16			 board_id,
+							 GError				**error);
+void		 synapticsmst_profile_apply		(const SynapticsMSTProfile	*profile);
+
+G_END_DECLS
+
+#endif /* __SYNAPTICSMST_PROFILE_H */
@@ -0,0 +1,252 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "synapticsmst-image.h"
+#include "synapticsmst-repository.h"
+
+#define REPOSITORY_INDEX	"index.conf"
+
+/**
+ * synapticsmst_repository_get_dirname:
+ *
+ * Gets the directory imported firmware images are kept in, which can be
+ * overridden with the SYNAPTICSMST_REPOSITORY_DIR environment variable.
+ *
+ * Returns: a directory name
+ **/
+const gchar *
+synapticsmst_repository_get_dirname (void)
+{
+	const gchar *tmp = g_getenv ("SYNAPTICSMST_REPOSITORY_DIR");
+	if (tmp != NULL)
+		return tmp;
+	return LOCALSTATEDIR "/lib/synapticsmst/firmware";
+}
+
+static gchar *
+synapticsmst_repository_get_index (void)
+{
+	return g_build_filename (synapticsmst_repository_get_dirname (), REPOSITORY_INDEX, NULL);
+}
+
+/**
+ * synapticsmst_repository_version_from_string:
+ * @text: a version such as "v5.05.007", or a filename containing "5_05_007"
+ *
+ * Packs a firmware version so that newer versions compare greater.
+ *
+ * Returns: the packed version, or 0 if @text has no version
+ **/
+guint32
+synapticsmst_repository_version_from_string (const gchar *text)
+{
+	g_autoptr(GRegex) regex = g_regex_new ("(\\d+)[._](\\d+)[._](\\d+)", 0, 0, NULL);
+	g_autoptr(GMatchInfo) match = NULL;
+	guint64 part[3];
+
+	if (text == NULL || !g_regex_match (regex, text, 0, &match))
+		return 0;
+	for (guint i = 0; i < 3; i++) {
+		g_autofree gchar *tmp = g_match_info_fetch (match, i + 1);
+		part[i] = g_ascii_strtoull (tmp, NULL, 10);
+	}
+	return (MIN (part[0], 0xFF) << 24) | (MIN (part[1], 0xFF) << 16) | MIN (part[2], 0xFFFF);
+}
+
+/**
+ * synapticsmst_repository_version_to_string:
+ * @version: a packed version
+ *
+ * Formats a version the same way as synapticsmst_device_get_version().
+ *
+ * Returns: a newly allocated string
+ **/
+gchar *
+synapticsmst_repository_version_to_string (guint32 version)
+{
+	return g_strdup_printf ("v%1u.%02u.%03u", version >> 24, (version >> 16) & 0xFF, version & 0xFFFF);
+}
+
+void
+synapticsmst_repository_entry_free (SynapticsMSTRepositoryEntry *entry)
+{
+	g_free (entry->filename);
+	g_free (entry);
+}
+
+static SynapticsMSTRepositoryEntry *
+synapticsmst_repository_entry_from_index (GKeyFile *kf, const gchar *group)
+{
+	SynapticsMSTRepositoryEntry *entry = g_new0 (SynapticsMSTRepositoryEntry, 1);
+	g_autofree gchar *version = NULL;
+
+	entry->filename = g_strdup (group);
+	entry->board_id = g_key_file_get_integer (kf, group, "BoardID", NULL);
+	version = g_key_file_get_string (kf, group, "Version", NULL);
+	entry->version = synapticsmst_repository_version_from_string (version);
+	entry->size = g_key_file_get_uint64 (kf, group, "Size", NULL);
+	entry->checksum = g_key_file_get_uint64 (kf, group, "Checksum", NULL);
+	entry->valid = g_key_file_get_boolean (kf, group, "Valid", NULL);
+	return entry;
+}
+
+/**
+ * synapticsmst_repository_import:
+ * @filename: a firmware image
+ * @version: the firmware version, or %NULL to take it from @filename
+ * @error: a #GError or %NULL
+ *
+ * Copies an image into the repository and indexes its board ID, version
+ * and checksum so that later lookups never reread it. Images
+ * failing validation are indexed too, so they are not validated again,
+ * but they are never returned by synapticsmst_repository_lookup().
+ *
+ * Returns: (transfer full): the new index entry, or %NULL for error
+ **/
+SynapticsMSTRepositoryEntry *
+synapticsmst_repository_import (const gchar *filename, const gchar *version, GError **error)
+{
+	const gchar *dirname = synapticsmst_repository_get_dirname ();
+	g_autofree gchar *basename = g_path_get_basename (filename);
+	g_autofree gchar *dest = g_build_filename (dirname, basename, NULL);
+	g_autofree gchar *index = synapticsmst_repository_get_index ();
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *version_str = NULL;
+	g_autoptr(GKeyFile) kf = g_key_file_new ();
+	g_autoptr(GError) error_local = NULL;
+	guint32 packed;
+	gsize len;
+
+	packed = synapticsmst_repository_version_from_string (version != NULL ? version : basename);
+	if (packed == 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "No firmware version in %s, please give one\n", basename);
+		return NULL;
+	}
+	if (g_strcmp0 (basename, REPOSITORY_INDEX) == 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid firmware name %s\n", basename);
+		return NULL;
+	}
+	if (!g_file_get_contents (filename, &data, &len, error))
+		return NULL;
+
+	/* everything a lookup needs, computed once */
+	g_key_file_load_from_file (kf, index, G_KEY_FILE_KEEP_COMMENTS, NULL);
+	version_str = synapticsmst_repository_version_to_string (packed);
+	g_key_file_set_integer (kf, basename, "BoardID", synapticsmst_image_get_board_id ((const guint8 *) data, len));
+	g_key_file_set_string (kf, basename, "Version", version_str);
+	g_key_file_set_uint64 (kf, basename, "Size", len);
+	g_key_file_set_uint64 (kf, basename, "Checksum", synapticsmst_image_checksum ((const guint8 *) data, len));
+	/* no longer used, indexes written before may still have it */
+	g_key_file_remove_key (kf, basename, "SectorCRC", NULL);
+	if (synapticsmst_image_validate ((const guint8 *) data, len, &error_local)) {
+		g_key_file_set_boolean (kf, basename, "Valid", TRUE);
+		g_key_file_remove_key (kf, basename, "Error", NULL);
+	}
+	else {
+		g_strchomp (error_local->message);
+		g_key_file_set_boolean (kf, basename, "Valid", FALSE);
+		g_key_file_set_string (kf, basename, "Error", error_local->message);
+	}
+
+	if (g_mkdir_with_parents (dirname, 0755) != 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create %s\n", dirname);
+		return NULL;
+	}
+	if (!g_file_set_contents (dest, data, len, error))
+		return NULL;
+	if (!g_key_file_save_to_file (kf, index, error))
+		return NULL;
+	return synapticsmst_repository_entry_from_index (kf, basename);
+}
+
+/**
+ * synapticsmst_repository_lookup:
+ * @board_id: the board ID
+ * @error: a #GError or %NULL
+ *
+ * Finds the newest valid image for a board using only the index.
+ *
+ * Returns: (transfer full): the index entry, or %NULL if there is none
+ **/
+SynapticsMSTRepositoryEntry *
+synapticsmst_repository_lookup (guint16 board_id, GError **error)
+{
+	g_autofree gchar *index = synapticsmst_repository_get_index ();
+	g_autoptr(GKeyFile) kf = g_key_file_new ();
+	g_auto(GStrv) groups = NULL;
+	g_autoptr(SynapticsMSTRepositoryEntry) best = NULL;
+
+	if (!g_key_file_load_from_file (kf, index, G_KEY_FILE_NONE, error))
+		return NULL;
+	groups = g_key_file_get_groups (kf, NULL);
+	for (guint i = 0; groups[i] != NULL; i++) {
+		g_autoptr(SynapticsMSTRepositoryEntry) entry = NULL;
+
+		if (!g_key_file_get_boolean (kf, groups[i], "Valid", NULL))
+			continue;
+		if (g_key_file_get_integer (kf, groups[i], "BoardID", NULL) != board_id)
+			continue;
+		entry = synapticsmst_repository_entry_from_index (kf, groups[i]);
+		if (best == NULL || entry->version > best->version) {
+			g_clear_pointer (&best, synapticsmst_repository_entry_free);
+			best = g_steal_pointer (&entry);
+		}
+	}
+	if (best == NULL) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No firmware for board ID 0x%04x in %s\n",
+			     board_id, synapticsmst_repository_get_dirname ());
+		return NULL;
+	}
+	return g_steal_pointer (&best);
+}
+
+/**
+ * synapticsmst_repository_load:
+ * @entry: an index entry
+ * @error: a #GError or %NULL
+ *
+ * Loads an indexed image. It is not validated again; only the size and
+ * checksum recorded at import are compared, to catch a replaced file.
+ *
+ * Returns: (transfer full): the image, or %NULL for error
+ **/
+GBytes *
+synapticsmst_repository_load (const SynapticsMSTRepositoryEntry *entry, GError **error)
+{
+	g_autofree gchar *filename = g_build_filename (synapticsmst_repository_get_dirname (), entry->filename, NULL);
+	gchar *data = NULL;
+	gsize len;
+
+	if (!g_file_get_contents (filename, &data, &len, error))
+		return NULL;
+	if (len != entry->size || synapticsmst_image_checksum ((const guint8 *) data, len) != entry->checksum) {
+		g_free (data);
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s changed since it was imported\n", filename);
+		return NULL;
+	}
+	return g_bytes_new_take (data, len);
+}
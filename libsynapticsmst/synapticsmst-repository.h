@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __SYNAPTICSMST_REPOSITORY_H
+#define __SYNAPTICSMST_REPOSITORY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	gchar		*filename;		/* relative to the repository */
+	guint16		 board_id;
+	guint32		 version;		/* major << 24 | minor << 16 | build */
+	guint32		 size;
+	guint32		 checksum;		/* as UPDC_CAL_EEPROM_CHECKSUM */
+	gboolean	 valid;
+} SynapticsMSTRepositoryEntry;
+
+const gchar	*synapticsmst_repository_get_dirname	(void);
+guint32		 synapticsmst_repository_version_from_string (const gchar	*text);
+gchar		*synapticsmst_repository_version_to_string (guint32		 version);
+SynapticsMSTRepositoryEntry *synapticsmst_repository_import (const gchar	*filename,
+							 const gchar		*version,
+							 GError			**error);
+SynapticsMSTRepositoryEntry *synapticsmst_repository_lookup (guint16		 board_id,
+							 GError			**error);
+GBytes		*synapticsmst_repository_load		(const SynapticsMSTRepositoryEntry *entry,
+							 GError			**error);
+void		 synapticsmst_repository_entry_free	(SynapticsMSTRepositoryEntry *entry);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SynapticsMSTRepositoryEntry, synapticsmst_repository_entry_free)
+
+G_END_DECLS
+
+#endif /* __SYNAPTICSMST_REPOSITORY_H */
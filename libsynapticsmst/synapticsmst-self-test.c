@@ -0,0 +1,291 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2016 Mario Limonciello <mario.limonciello@dell.com>
+ * Copyright (C) 2017 Peichen Huang <peichenhuang@tw.synaptics.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib-object.h>
+
+#include "synapticsmst-common.h"
+#include "synapticsmst-device.h"
+#include "synapticsmst-emulator.h"
+#include "synapticsmst-image.h"
+
+#define TEST_IMAGE_SIZE		0x4000
+#define TEST_CODE_SIZE		0x1000
+#define TEST_BOARD_ID		0x0123
+#define TEST_ATTEMPTS		5
+
+/* the smallest image that validates: blank EDID, the board ID in the
+ * first configuration block, and code filled from seed */
+static guint8 *
+synapticsmst_test_image_new (guint8 seed)
+{
+	guint8 *data = g_malloc (TEST_IMAGE_SIZE);
+	guint8 *code = data + SYNAPTICSMST_IMAGE_CODE_OFFSET;
+	guint8 sum = 0;
+
+	memset (data, 0x00, SYNAPTICSMST_IMAGE_CODE_OFFSET);
+	memset (code, 0xFF, TEST_IMAGE_SIZE - SYNAPTICSMST_IMAGE_CODE_OFFSET);
+	data[ADDR_CUSTOMER_ID] = TEST_BOARD_ID >> 8;
+	data[ADDR_BOARD_ID] = TEST_BOARD_ID & 0xFF;
+	data[0x1FF] = -(data[ADDR_CUSTOMER_ID] + data[ADDR_BOARD_ID]);
+
+	/* size header, code, and a checksum byte for both */
+	code[0] = TEST_CODE_SIZE >> 8;
+	code[1] = TEST_CODE_SIZE & 0xFF;
+	for (guint i = 2; i < TEST_CODE_SIZE + 16; i++)
+		code[i] = seed + i * 7;
+	for (guint i = 0; i < TEST_CODE_SIZE + 16; i++)
+		sum += code[i];
+	code[TEST_CODE_SIZE + 16] = -sum;
+	return data;
+}
+
+/* what the whole flash holds once image is written, SPI flash beyond the
+ * image reading back erased */
+static guint8 *
+synapticsmst_test_flash_new (const guint8 *image)
+{
+	guint8 *flash = g_malloc (SYNAPTICSMST_IMAGE_MAX_SIZE);
+
+	memset (flash, 0xFF, SYNAPTICSMST_IMAGE_MAX_SIZE);
+	memcpy (flash, image, TEST_IMAGE_SIZE);
+	return flash;
+}
+
+/* reads the flash back directly, with faults off */
+static guint8 *
+synapticsmst_test_read_flash (void)
+{
+	guint8 *flash = g_malloc (SYNAPTICSMST_IMAGE_MAX_SIZE);
+
+	g_assert_cmpint (synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (0)), ==, 1);
+	synapticsmst_common_config_connection (0, 0);
+	g_assert_cmpint (synapticsmst_common_enable_remote_control (), ==, DPCD_SUCCESS);
+	g_assert_cmpint (synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, SYNAPTICSMST_IMAGE_MAX_SIZE, 0, flash), ==, DPCD_SUCCESS);
+	g_assert_cmpint (synapticsmst_common_disable_remote_control (), ==, DPCD_SUCCESS);
+	synapticsmst_common_close_aux_node ();
+	return flash;
+}
+
+static void
+synapticsmst_test_assert_flash (const guint8 *image)
+{
+	g_autofree guint8 *expected = synapticsmst_test_flash_new (image);
+	g_autofree guint8 *flash = synapticsmst_test_read_flash ();
+
+	g_assert_cmpint (memcmp (flash, expected, SYNAPTICSMST_IMAGE_MAX_SIZE), ==, 0);
+}
+
+static void
+synapticsmst_test_attach (const guint8 *image)
+{
+	g_autofree guint8 *flash = synapticsmst_test_flash_new (image);
+
+	synapticsmst_emulator_attach (synapticsmst_device_aux_node_to_string (0), flash, SYNAPTICSMST_IMAGE_MAX_SIZE);
+}
+
+static void
+synapticsmst_flash_func (void)
+{
+	g_autofree guint8 *old = synapticsmst_test_image_new (0x00);
+	g_autofree guint8 *new = synapticsmst_test_image_new (0x5A);
+	g_autoptr(SynapticsMSTDevice) device = NULL;
+	g_autoptr(GBytes) fw = NULL;
+	g_autoptr(GError) error = NULL;
+	gboolean ret;
+
+	synapticsmst_test_attach (old);
+	device = synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_DIRECT, 0, 0, 0);
+	fw = g_bytes_new (new, TEST_IMAGE_SIZE);
+	ret = synapticsmst_device_write_firmware (device, fw, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (synapticsmst_device_get_boardID (device), ==, TEST_BOARD_ID);
+	synapticsmst_test_assert_flash (new);
+	synapticsmst_emulator_detach ();
+}
+
+static void
+synapticsmst_region_func (void)
+{
+	g_autofree guint8 *old = synapticsmst_test_image_new (0x00);
+	g_autofree guint8 *new = synapticsmst_test_image_new (0x00);
+	g_autoptr(SynapticsMSTDevice) device = NULL;
+	g_autoptr(GBytes) fw = NULL;
+	g_autoptr(GError) error = NULL;
+	gboolean ret;
+
+	/* new configuration, same board ID and code */
+	new[0x150] = 0x55;
+	new[0x1FF] -= 0x55;
+	new[SYNAPTICSMST_IMAGE_CODE_OFFSET + 2] += 0x01;
+	new[SYNAPTICSMST_IMAGE_CODE_OFFSET + TEST_CODE_SIZE + 16] -= 0x01;
+
+	synapticsmst_test_attach (old);
+	device = synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_DIRECT, 0, 0, 0);
+	fw = g_bytes_new (new, TEST_IMAGE_SIZE);
+	ret = synapticsmst_device_write_region (device, SYNAPTICSMST_DEVICE_REGION_CONFIG, fw, 0, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* only the configuration changed, the code didn't follow the image */
+	memcpy (old + 0x100, new + 0x100, 0x200);
+	synapticsmst_test_assert_flash (old);
+	synapticsmst_emulator_detach ();
+}
+
+static void
+synapticsmst_audit_func (void)
+{
+	g_autofree guint8 *image = synapticsmst_test_image_new (0x33);
+	g_autofree guint8 *flash = synapticsmst_test_flash_new (image);
+	g_autoptr(SynapticsMSTDevice) device = NULL;
+	g_autoptr(GError) error = NULL;
+	guint32 checksum = 0;
+	gboolean ret;
+
+	synapticsmst_test_attach (image);
+	device = synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_DIRECT, 0, 0, 0);
+	ret = synapticsmst_device_audit (device, &checksum, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmphex (checksum, ==, synapticsmst_image_checksum (flash, SYNAPTICSMST_IMAGE_MAX_SIZE));
+	g_assert_cmpint (synapticsmst_device_get_boardID (device), ==, TEST_BOARD_ID);
+	g_assert_cmpstr (synapticsmst_device_get_chipID (device), ==, "VMM5331");
+	synapticsmst_emulator_detach ();
+}
+
+/* the emulator's mailbox is plain DPCD memory, so moving REG_RC_OFFSET
+ * behind the library's back shows whether a command rewrote it */
+static void
+synapticsmst_mailbox_func (void)
+{
+	g_autofree guint8 *image = synapticsmst_test_image_new (0x00);
+	guint8 stale[4] = { 0x0E, 0x01, 0x00, 0x00 };
+	guint8 buf[2];
+	synapticsmst_rc_op enable[] = {
+		{ UPDC_ENABLE_RC, 0, 0, NULL, 0, NULL, 0 },
+		{ UPDC_READ_FROM_EEPROM, 2, 0x150, NULL, 2, buf, 0 },
+	};
+	synapticsmst_rc_op read[] = {
+		{ UPDC_READ_FROM_EEPROM, 2, 0x150, NULL, 2, buf, 0 },
+	};
+	synapticsmst_rc_op disable[] = {
+		{ UPDC_READ_FROM_EEPROM, 2, 0x150, NULL, 2, buf, 0 },
+		{ UPDC_DISABLE_RC, 0, 0, NULL, 0, NULL, 0 },
+	};
+
+	synapticsmst_test_attach (image);
+	g_assert_cmpint (synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (0)), ==, 1);
+	synapticsmst_common_config_connection (0, 0);
+	g_assert_cmpint (synapticsmst_common_rc_run_list (enable, G_N_ELEMENTS (enable)), ==, G_N_ELEMENTS (enable));
+	g_assert_cmphex (buf[0], ==, 0x00);
+
+	/* the same offset and length again are not written, so the command
+	 * reads the board ID from the stale offset */
+	synapticsmst_emulator_write (REG_RC_OFFSET, stale, sizeof (stale));
+	g_assert_cmpint (synapticsmst_common_rc_run_list (read, G_N_ELEMENTS (read)), ==, G_N_ELEMENTS (read));
+	g_assert_cmphex (buf[0], ==, TEST_BOARD_ID >> 8);
+	g_assert_cmphex (buf[1], ==, TEST_BOARD_ID & 0xFF);
+
+	/* a command outside a list forgets what the mailbox holds */
+	g_assert_cmpint (synapticsmst_common_rc_get_command (UPDC_READ_FROM_EEPROM, 2, 0x100, buf), ==, DPCD_SUCCESS);
+	synapticsmst_emulator_write (REG_RC_OFFSET, stale, sizeof (stale));
+	g_assert_cmpint (synapticsmst_common_rc_run_list (disable, G_N_ELEMENTS (disable)), ==, G_N_ELEMENTS (disable));
+	g_assert_cmphex (buf[0], ==, 0x00);
+	synapticsmst_common_close_aux_node ();
+	synapticsmst_emulator_detach ();
+}
+
+/* an update may fail outright under faults, but must never leave the hub
+ * in a state that the next attempt can't recover from */
+static void
+synapticsmst_test_flash_with_faults (const synapticsmst_faults *faults, SynapticsMSTDeviceStats *stats)
+{
+	g_autofree guint8 *old = synapticsmst_test_image_new (0x00);
+	g_autofree guint8 *new = synapticsmst_test_image_new (0x5A);
+	g_autoptr(SynapticsMSTDevice) device = NULL;
+	g_autoptr(GBytes) fw = NULL;
+	gboolean ret = FALSE;
+
+	synapticsmst_test_attach (old);
+	synapticsmst_common_set_faults (faults);
+	device = synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_DIRECT, 0, 0, 0);
+	fw = g_bytes_new (new, TEST_IMAGE_SIZE);
+	for (guint i = 0; i < TEST_ATTEMPTS && !ret; i++) {
+		g_autoptr(GError) error = NULL;
+		ret = synapticsmst_device_write_firmware (device, fw, &error);
+		if (!ret)
+			g_debug ("attempt %u: %s", i + 1, error->message);
+	}
+	synapticsmst_common_set_faults (NULL);
+	g_assert (ret);
+	*stats = *synapticsmst_device_get_stats (device);
+	synapticsmst_test_assert_flash (new);
+	synapticsmst_emulator_detach ();
+}
+
+/* the rates of the benchmark profiles, plus one scripted fault well into
+ * the write phase so every run has something to recover from */
+static void
+synapticsmst_faults_lossy_aux_func (void)
+{
+	synapticsmst_faults faults = { .seed = 1, .aux_latency = 100, .aux_fail = 2, .script = "aux@500" };
+	SynapticsMSTDeviceStats stats;
+
+	synapticsmst_test_flash_with_faults (&faults, &stats);
+	g_assert_cmpuint (stats.retries, >, 0);
+}
+
+static void
+synapticsmst_faults_stuck_busy_func (void)
+{
+	synapticsmst_faults faults = { .seed = 1, .aux_latency = 100, .rc_stuck = 1, .script = "stuck@100" };
+	SynapticsMSTDeviceStats stats;
+
+	synapticsmst_test_flash_with_faults (&faults, &stats);
+	g_assert_cmpuint (stats.recoveries, >, 0);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	/* only critical and error are fatal */
+	g_log_set_fatal_mask (NULL, G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL);
+
+	/* results must not depend on a calibrated profile of this machine */
+	g_setenv ("SYNAPTICSMST_PROFILE_FILE", "/dev/null", TRUE);
+
+	/* tests go here */
+	g_test_add_func ("/synapticsmst/flash", synapticsmst_flash_func);
+	g_test_add_func ("/synapticsmst/region", synapticsmst_region_func);
+	g_test_add_func ("/synapticsmst/audit", synapticsmst_audit_func);
+	g_test_add_func ("/synapticsmst/mailbox", synapticsmst_mailbox_func);
+	g_test_add_func ("/synapticsmst/faults/lossy-aux", synapticsmst_faults_lossy_aux_func);
+	g_test_add_func ("/synapticsmst/faults/stuck-busy", synapticsmst_faults_stuck_busy_func);
+	return g_test_run ();
+}
@@ -22,9 +22,16 @@
  */
 
 #include "config.h"
+#include "synapticsmst-broker-client.h"
 #include "synapticsmst-common.h"
+#include "synapticsmst-core.h"
 #include "synapticsmst-device.h"
+#include "synapticsmst-emulator.h"
 #include "synapticsmst-error.h"
+#include "synapticsmst-image.h"
+#include "synapticsmst-monitor.h"
+#include "synapticsmst-profile.h"
+#include "synapticsmst-repository.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -38,7 +45,14 @@ typedef struct {
         GCancellable            *cancellable;
         GPtrArray               *cmd_array;
         gboolean                 force;
+        gboolean                 dry_run;
+        gboolean                 use_repository;
+        gboolean                 activate;
+        gboolean                 no_broker;
+        gboolean                 transport_options;
         gchar                   *device_maj_min;
+        gchar                   *metrics_file;
+        gchar                   *metrics_format;
 		GPtrArray               *device_array;
 } SynapticsMSTToolPrivate;
 
@@ -48,6 +62,8 @@ synapticsmst_tool_private_free (SynapticsMSTToolPrivate *priv)
         if (priv == NULL)
                 return;
         g_free (priv->device_maj_min);
+        g_free (priv->metrics_file);
+        g_free (priv->metrics_format);
         g_object_unref (priv->cancellable);
         if (priv->cmd_array != NULL)
                 g_ptr_array_unref (priv->cmd_array);
@@ -161,7 +177,7 @@ synapticsmst_tool_get_descriptions (GPtrArray *array)
 }
 
 static gboolean
-synapticsmst_tool_scan_aux_nodes (SynapticsMSTToolPrivate *priv, GError **error)
+synapticsmst_tool_scan_aux_node_range (SynapticsMSTToolPrivate *priv, guint8 first, guint8 last, GError **error)
 {
 	SynapticsMSTDevice *device = NULL;
 	SynapticsMSTDevice *cascade_device = NULL;
@@ -172,7 +188,7 @@ synapticsmst_tool_scan_aux_nodes (SynapticsMSTToolPrivate *priv, GError **error)
 	gint32 fd;
 
 	priv->device_array = g_ptr_array_new ();
-	for (guint8 i=0; i<MAX_DP_AUX_NODES; i++) {
+	for (guint8 i=first; i<=last && i<MAX_DP_AUX_NODES; i++) {
 		fd = synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (i));
 		if (fd > 0) {
 			device = synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_DIRECT, i, 0, 0);
@@ -184,14 +200,21 @@ synapticsmst_tool_scan_aux_nodes (SynapticsMSTToolPrivate *priv, GError **error)
 			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to open aux node, please try sudo to get permission\n");
 			return FALSE;
 		}
+		else if (fd == -2) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY, "Aux node %d is in use by another process\n", i);
+			return FALSE;
+		}
 	}
 
 	if (nRet) {
 		for (guint8 i=0; i<priv->device_array->len; i++) {
 			device = g_ptr_array_index (priv->device_array, i);
 			aux_node = synapticsmst_device_get_aux_node (device);
-			if (synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (aux_node))) {
-				synapticsmst_device_enable_remote_control (device, error);
+			if (synapticsmst_common_open_aux_node (synapticsmst_device_aux_node_to_string (aux_node)) > 0) {
+				if (!synapticsmst_device_enable_remote_control (device, error)) {
+					synapticsmst_common_close_aux_node ();
+					return FALSE;
+				}
 				for (guint8 j=0; j<2; j++) {
 					if (synapticsmst_device_scan_cascade_device (device, j)) {
 						layer = synapticsmst_device_get_layer (device) + 1;
@@ -213,10 +236,27 @@ synapticsmst_tool_scan_aux_nodes (SynapticsMSTToolPrivate *priv, GError **error)
 	if (!nRet) {
 		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "No Synaptics MST Device Found\n");
 	}
+	else {
+		/* one hub seen through two aux nodes must not be flashed twice */
+		GPtrArray *unique;
+
+		synapticsmst_device_sort_by_route (priv->device_array);
+		unique = synapticsmst_device_dedupe (priv->device_array, priv->cancellable, error);
+		if (unique == NULL)
+			return FALSE;
+		g_ptr_array_unref (priv->device_array);
+		priv->device_array = unique;
+	}
 
 	return nRet;
 }
 
+static gboolean
+synapticsmst_tool_scan_aux_nodes (SynapticsMSTToolPrivate *priv, GError **error)
+{
+	return synapticsmst_tool_scan_aux_node_range (priv, 0, MAX_DP_AUX_NODES - 1, error);
+}
+
 static gboolean
 synapticsmst_tool_enumerate (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
 {
@@ -250,6 +290,116 @@ synapticsmst_tool_enumerate (SynapticsMSTToolPrivate *priv, gchar **values, guin
 	}
 	return TRUE;
 }
+
+/* the index alone says whether an update is waiting, nothing is reread */
+static void
+synapticsmst_tool_audit_repository (SynapticsMSTDevice *device)
+{
+	g_autoptr(SynapticsMSTRepositoryEntry) entry = NULL;
+	g_autofree gchar *version = NULL;
+	guint32 current;
+
+	entry = synapticsmst_repository_lookup (synapticsmst_device_get_boardID (device), NULL);
+	if (entry == NULL)
+		return;
+	version = synapticsmst_repository_version_to_string (entry->version);
+	current = synapticsmst_repository_version_from_string (synapticsmst_device_get_version (device));
+	if (entry->version > current)
+		g_print (", update to %s available as %s", version, entry->filename);
+	else
+		g_print (", up to date with %s", version);
+}
+
+static gboolean
+synapticsmst_tool_audit (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	guint n_failed = 0;
+
+	/* check avaliable dp aux nodes and add devices */
+	if (!synapticsmst_tool_scan_aux_nodes (priv, error))
+		return FALSE;
+
+	/* keep going so one bad hub doesn't hide the rest of the fleet */
+	for (guint8 i=0; i<priv->device_array->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (priv->device_array, i);
+		guint32 checksum = 0;
+		g_autoptr(GError) error_local = NULL;
+
+		g_print ("[Device %1d] aux node %u layer %u rad 0x%04x: ", i+1,
+			 synapticsmst_device_get_aux_node (device),
+			 synapticsmst_device_get_layer (device),
+			 synapticsmst_device_get_rad (device));
+		if (!synapticsmst_device_audit (device, &checksum, priv->cancellable, &error_local)) {
+			g_print ("%s", error_local->message);
+			n_failed++;
+			continue;
+		}
+		g_print ("%s %s board 0x%04x checksum 0x%08x",
+			 synapticsmst_device_get_chipID (device),
+			 synapticsmst_device_get_version (device),
+			 synapticsmst_device_get_boardID (device),
+			 checksum);
+		synapticsmst_tool_audit_repository (device);
+		g_print ("\n");
+	}
+	if (n_failed > 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to audit %u devices\n", n_failed);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+synapticsmst_tool_progress_cb (SynapticsMSTDevice *device,
+			       const SynapticsMSTDeviceProgress *progress,
+			       gpointer user_data)
+{
+	guint percentage = 100;
+
+	if (progress->bytes_total > 0)
+		percentage = (guint) ((guint64) progress->bytes_done * 100 / progress->bytes_total);
+	g_print ("\r%s... %u%%", synapticsmst_device_phase_to_string (progress->phase), percentage);
+	if (progress->phase == SYNAPTICSMST_DEVICE_PHASE_WRITE && progress->bytes_done < progress->bytes_total)
+		g_print (" (%.1f KiB/s, %.0fs left)", progress->throughput_avg / 1024, progress->eta);
+	if (progress->bytes_done == progress->bytes_total)
+		g_print ("\n");
+}
+
+static gboolean
+synapticsmst_tool_flash_estimate (SynapticsMSTToolPrivate *priv, SynapticsMSTDevice *device, GBytes *fw, GError **error)
+{
+	SynapticsMSTDeviceEstimate estimate;
+	gdouble total;
+
+	if (!synapticsmst_device_estimate_flash (device, fw, &estimate, priv->cancellable, error))
+		return FALSE;
+	total = estimate.erase_time + estimate.write_time + estimate.verify_time;
+	g_print ("Dry run, nothing was written\n");
+	g_print ("  RC round trip : %.2f ms at layer %u\n", estimate.rc_latency * 1000, synapticsmst_device_get_layer (device));
+	g_print ("  Erase         : %.1f s\n", estimate.erase_time);
+	g_print ("  Write         : %.1f s (%u of %u bytes, %.0f%%)\n",
+		 estimate.write_time, estimate.bytes_written, estimate.bytes_total,
+		 100.f * estimate.bytes_written / estimate.bytes_total);
+	g_print ("  Verify        : %.1f s\n", estimate.verify_time);
+	g_print ("  Total         : %.1f s\n", total);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_tool_activate_device (SynapticsMSTToolPrivate *priv, SynapticsMSTDevice *device, GError **error)
+{
+	g_autofree gchar *version_old = g_strdup (synapticsmst_device_get_version (device));
+
+	g_print ("Activating firmware...\n");
+	if (!synapticsmst_device_activate (device, priv->cancellable, error))
+		return FALSE;
+	if (g_strcmp0 (version_old, synapticsmst_device_get_version (device)) == 0)
+		g_print ("Device is back, firmware version is still %s\n", version_old);
+	else
+		g_print ("Device is back, firmware version %s -> %s\n", version_old, synapticsmst_device_get_version (device));
+	return TRUE;
+}
+
 static gboolean
 synapticsmst_tool_flash (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
 {
@@ -258,23 +408,57 @@ synapticsmst_tool_flash (SynapticsMSTToolPrivate *priv, gchar **values, guint8 d
 	g_autoptr (GBytes) fw = NULL;
 	gsize len;
 
+	/* with --repository the only argument is the device index */
+	if (priv->use_repository) {
+		if (values[0] == NULL) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected DEVICE-INDEX\n");
+			return FALSE;
+		}
+		device_index = strtol (values[0], NULL, 10);
+	}
+
     /* check avaliable dp aux nodes and add devices */
 	if (!synapticsmst_tool_scan_aux_nodes (priv, error)) {
 		return FALSE;
 	}
+	if (device_index == 0 || device_index > priv->device_array->len) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid device index %u\n", device_index);
+		return FALSE;
+	}
 
 	device = g_ptr_array_index (priv->device_array, (device_index - 1));
 	if (synapticsmst_device_enumerate_device (device, error)) {
 		if (synapticsmst_device_boardID_to_string (synapticsmst_device_get_boardID (device)) != NULL) {
-			if (!g_file_get_contents ((const gchar *)*values, (gchar **) &data, &len, error)) {
+			if (priv->use_repository) {
+				g_autoptr(SynapticsMSTRepositoryEntry) entry = NULL;
+				g_autofree gchar *version = NULL;
+
+				entry = synapticsmst_repository_lookup (synapticsmst_device_get_boardID (device), error);
+				if (entry == NULL)
+					return FALSE;
+				fw = synapticsmst_repository_load (entry, error);
+				if (fw == NULL)
+					return FALSE;
+				version = synapticsmst_repository_version_to_string (entry->version);
+				g_print ("Using %s (%s) from %s\n", entry->filename, version, synapticsmst_repository_get_dirname ());
+			}
+			else if (!g_file_get_contents ((const gchar *)*values, (gchar **) &data, &len, error)) {
 				g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Failed to flash firmware : can't load file %s\n", (const char *)values);
 				return FALSE;
 			}
-
-			fw = g_bytes_new (data, len);
+			else {
+				fw = g_bytes_new (data, len);
+			}
+			if (priv->dry_run)
+				return synapticsmst_tool_flash_estimate (priv, device, fw, error);
+			synapticsmst_device_set_progress_func (device, synapticsmst_tool_progress_cb, NULL, NULL);
 			if (!synapticsmst_device_write_firmware (device, fw, error)) {
 				return FALSE;
 			}
+			else if (priv->activate) {
+				g_print ("Update Sucessfully.\n");
+				return synapticsmst_tool_activate_device (priv, device, error);
+			}
 			else {
 				g_print ("Update Sucessfully. Please reset device to apply new firmware\n");
 			}
@@ -291,6 +475,592 @@ synapticsmst_tool_flash (SynapticsMSTToolPrivate *priv, gchar **values, guint8 d
 	return TRUE;
 }
 
+static gboolean
+synapticsmst_tool_activate (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	SynapticsMSTDevice *device;
+
+	if (values[0] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected DEVICE-INDEX\n");
+		return FALSE;
+	}
+	device_index = strtol (values[0], NULL, 10);
+
+	/* check avaliable dp aux nodes and add devices */
+	if (!synapticsmst_tool_scan_aux_nodes (priv, error))
+		return FALSE;
+	if (device_index == 0 || device_index > priv->device_array->len) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid device index %u\n", device_index);
+		return FALSE;
+	}
+
+	device = g_ptr_array_index (priv->device_array, (device_index - 1));
+	if (!synapticsmst_device_enumerate_device (device, error))
+		return FALSE;
+	return synapticsmst_tool_activate_device (priv, device, error);
+}
+
+static gboolean
+synapticsmst_tool_checksum (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	SynapticsMSTDevice *device;
+	guint32 checksum = 0;
+
+	if (values[0] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected DEVICE-INDEX\n");
+		return FALSE;
+	}
+	device_index = strtol (values[0], NULL, 10);
+
+	/* check avaliable dp aux nodes and add devices */
+	if (!synapticsmst_tool_scan_aux_nodes (priv, error))
+		return FALSE;
+	if (device_index == 0 || device_index > priv->device_array->len) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid device index %u\n", device_index);
+		return FALSE;
+	}
+
+	device = g_ptr_array_index (priv->device_array, (device_index - 1));
+	if (!synapticsmst_device_get_flash_checksum (device, SYNAPTICSMST_IMAGE_MAX_SIZE, 0, &checksum, error))
+		return FALSE;
+	g_print ("0x%08x\n", checksum);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_tool_update_region (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	SynapticsMSTDevice *device;
+	SynapticsMSTDeviceRegion region;
+	SynapticsMSTDeviceWriteFlags flags = SYNAPTICSMST_DEVICE_WRITE_FLAG_NONE;
+	g_autofree gchar *data = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	gsize len;
+
+	if (g_strv_length (values) < 3) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected REGION FILE DEVICE-INDEX\n");
+		return FALSE;
+	}
+	region = synapticsmst_device_region_from_string (values[0]);
+	if (region == SYNAPTICSMST_DEVICE_REGION_LAST) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid region %s, expected edid, config or code\n", values[0]);
+		return FALSE;
+	}
+	if (!g_file_get_contents (values[1], &data, &len, error))
+		return FALSE;
+	blob = g_bytes_new (data, len);
+	device_index = strtol (values[2], NULL, 10);
+
+	/* check avaliable dp aux nodes and add devices */
+	if (!synapticsmst_tool_scan_aux_nodes (priv, error))
+		return FALSE;
+	if (device_index == 0 || device_index > priv->device_array->len) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid device index %u\n", device_index);
+		return FALSE;
+	}
+
+	device = g_ptr_array_index (priv->device_array, (device_index - 1));
+	if (!synapticsmst_device_enumerate_device (device, error))
+		return FALSE;
+	synapticsmst_device_set_progress_func (device, synapticsmst_tool_progress_cb, NULL, NULL);
+	if (priv->force)
+		flags |= SYNAPTICSMST_DEVICE_WRITE_FLAG_FORCE;
+	if (!synapticsmst_device_write_region (device, region, blob, flags, priv->cancellable, error))
+		return FALSE;
+	g_print ("Updated %s region. Please reset device to apply it\n", values[0]);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_tool_import (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	g_autoptr(SynapticsMSTRepositoryEntry) entry = NULL;
+	g_autofree gchar *version = NULL;
+	const gchar *board;
+
+	if (values[0] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected FILE [VERSION]\n");
+		return FALSE;
+	}
+	entry = synapticsmst_repository_import (values[0], values[1], error);
+	if (entry == NULL)
+		return FALSE;
+
+	version = synapticsmst_repository_version_to_string (entry->version);
+	board = synapticsmst_device_boardID_to_string (entry->board_id);
+	g_print ("Imported %s into %s\n", entry->filename, synapticsmst_repository_get_dirname ());
+	g_print ("  Board ID : 0x%04x (%s)\n", entry->board_id, board != NULL ? board : "unknown");
+	g_print ("  Version  : %s\n", version);
+	g_print ("  Checksum : 0x%08x over %u bytes\n", entry->checksum, entry->size);
+	if (!entry->valid) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s is invalid and will never be flashed\n", entry->filename);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_tool_calibrate (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	SynapticsMSTDevice *device;
+	SynapticsMSTProfile profile;
+	guint16 board_id;
+
+	if (values[0] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected DEVICE-INDEX\n");
+		return FALSE;
+	}
+	device_index = strtol (values[0], NULL, 10);
+
+	/* check avaliable dp aux nodes and add devices */
+	if (!synapticsmst_tool_scan_aux_nodes (priv, error))
+		return FALSE;
+	if (device_index == 0 || device_index > priv->device_array->len) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid device index %u\n", device_index);
+		return FALSE;
+	}
+
+	device = g_ptr_array_index (priv->device_array, (device_index - 1));
+	if (!synapticsmst_device_enumerate_device (device, error))
+		return FALSE;
+	g_print ("Calibrating, this reads the flash many times...\n");
+	if (!synapticsmst_device_calibrate (device, priv->cancellable, error))
+		return FALSE;
+
+	board_id = synapticsmst_device_get_boardID (device);
+	if (!synapticsmst_profile_load (&profile, board_id, error))
+		return FALSE;
+	g_print ("Profile for board ID 0x%04x saved to %s\n", board_id, synapticsmst_profile_get_filename ());
+	g_print ("  Unit size     : %u bytes\n", profile.unit_size);
+	g_print ("  Poll interval : %u us\n", profile.poll_interval);
+	g_print ("  Max wait time : %u ms\n", profile.max_wait_time);
+	g_print ("  Block unit    : %u bytes\n", profile.block_unit);
+	g_print ("  Write retries : %u\n", profile.write_retries);
+	g_print ("  Read speed    : %.1f KiB/s\n", profile.throughput / 1024);
+	return TRUE;
+}
+
+#define DPCD_ABSENT		0xFFFF
+
+/* "0x200-0x20f" is inclusive, "0x200+16" is a length */
+static GArray *
+synapticsmst_tool_parse_dpcd_ranges (const gchar *text, GError **error)
+{
+	g_auto(GStrv) split = g_strsplit (text, ",", -1);
+	g_autoptr(GArray) ranges = g_array_new (FALSE, FALSE, sizeof (SynapticsMSTDeviceDpcdRange));
+
+	for (guint i = 0; split[i] != NULL; i++) {
+		SynapticsMSTDeviceDpcdRange range;
+		gchar *endptr = NULL;
+		guint64 address;
+		guint64 length;
+		guint64 end;
+
+		/* parsed wide and checked before narrowing to the 32 bit range */
+		address = g_ascii_strtoull (split[i], &endptr, 0);
+		if (endptr == split[i] || address >= DPCD_ADDRESS_SPACE)
+			goto invalid;
+		if (*endptr == '\0') {
+			length = 1;
+		}
+		else if (*endptr == '-') {
+			const gchar *tmp = endptr + 1;
+			end = g_ascii_strtoull (tmp, &endptr, 0);
+			if (endptr == tmp || *endptr != '\0' || end < address || end >= DPCD_ADDRESS_SPACE)
+				goto invalid;
+			length = end - address + 1;
+		}
+		else if (*endptr == '+') {
+			const gchar *tmp = endptr + 1;
+			length = g_ascii_strtoull (tmp, &endptr, 0);
+			if (endptr == tmp || *endptr != '\0' || length == 0 || length > DPCD_ADDRESS_SPACE - address)
+				goto invalid;
+		}
+		else {
+			goto invalid;
+		}
+		range.address = address;
+		range.length = length;
+		g_array_append_val (ranges, range);
+		continue;
+invalid:
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid DPCD range %s\n", split[i]);
+		return NULL;
+	}
+	return g_steal_pointer (&ranges);
+}
+
+/* one value per DPCD address, DPCD_ABSENT where the snapshot has none */
+static guint16 *
+synapticsmst_tool_load_dpcd_snapshot (const gchar *filename, GError **error)
+{
+	g_autofree gchar *data = NULL;
+	g_auto(GStrv) lines = NULL;
+	g_autofree guint16 *values = g_new (guint16, DPCD_ADDRESS_SPACE);
+
+	if (!g_file_get_contents (filename, &data, NULL, error))
+		return NULL;
+	for (guint32 i = 0; i < DPCD_ADDRESS_SPACE; i++)
+		values[i] = DPCD_ABSENT;
+
+	lines = g_strsplit (data, "\n", -1);
+	for (guint i = 0; lines[i] != NULL; i++) {
+		gchar *endptr = NULL;
+		guint64 address;
+
+		if (lines[i][0] == '#' || lines[i][0] == '\0')
+			continue;
+		address = g_ascii_strtoull (lines[i], &endptr, 16);
+		if (endptr == lines[i])
+			goto invalid;
+		while (*endptr != '\0') {
+			const gchar *tmp = endptr;
+			guint64 value = g_ascii_strtoull (tmp, &endptr, 16);
+			if (endptr == tmp || value > 0xFF || address >= DPCD_ADDRESS_SPACE)
+				goto invalid;
+			values[address++] = value;
+			while (g_ascii_isspace (*endptr))
+				endptr++;
+		}
+		continue;
+invalid:
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			     "Invalid snapshot %s at line %u\n", filename, i + 1);
+		return NULL;
+	}
+	return g_steal_pointer (&values);
+}
+
+static gboolean
+synapticsmst_tool_dpcd_dump (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	SynapticsMSTDevice *device;
+	GString *str;
+	g_autofree gchar *data = NULL;
+	g_autoptr(GArray) ranges = NULL;
+	g_autoptr(GPtrArray) blobs = NULL;
+
+	if (values[0] == NULL || values[1] == NULL || values[2] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected DEVICE-INDEX RANGES FILE\n");
+		return FALSE;
+	}
+	device_index = strtol (values[0], NULL, 10);
+	ranges = synapticsmst_tool_parse_dpcd_ranges (values[1], error);
+	if (ranges == NULL)
+		return FALSE;
+
+	/* check avaliable dp aux nodes and add devices */
+	if (!synapticsmst_tool_scan_aux_nodes (priv, error))
+		return FALSE;
+	if (device_index == 0 || device_index > priv->device_array->len) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid device index %u\n", device_index);
+		return FALSE;
+	}
+	device = g_ptr_array_index (priv->device_array, (device_index - 1));
+	blobs = synapticsmst_device_read_dpcd_ranges (device, ranges, priv->cancellable, error);
+	if (blobs == NULL)
+		return FALSE;
+
+	/* 16 bytes per line, each range starting a new line */
+	str = g_string_new (NULL);
+	g_string_append_printf (str, "# synapticsmst dpcd snapshot aux_node=%u layer=%u rad=0x%04x\n",
+				synapticsmst_device_get_aux_node (device),
+				synapticsmst_device_get_layer (device),
+				synapticsmst_device_get_rad (device));
+	for (guint i = 0; i < ranges->len; i++) {
+		SynapticsMSTDeviceDpcdRange *range = &g_array_index (ranges, SynapticsMSTDeviceDpcdRange, i);
+		gsize len;
+		const guint8 *buf = g_bytes_get_data (g_ptr_array_index (blobs, i), &len);
+		for (gsize j = 0; j < len; j++) {
+			if (j % 16 == 0)
+				g_string_append_printf (str, "%s%05x", j > 0 ? "\n" : "", (guint) (range->address + j));
+			g_string_append_printf (str, " %02x", buf[j]);
+		}
+		g_string_append_c (str, '\n');
+	}
+	data = g_string_free (str, FALSE);
+	if (!g_file_set_contents (values[2], data, -1, error))
+		return FALSE;
+	g_print ("Saved %u ranges to %s\n", ranges->len, values[2]);
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_tool_dpcd_diff (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	guint changes = 0;
+	g_autofree guint16 *old_values = NULL;
+	g_autofree guint16 *new_values = NULL;
+
+	if (values[0] == NULL || values[1] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected OLD-FILE NEW-FILE\n");
+		return FALSE;
+	}
+	old_values = synapticsmst_tool_load_dpcd_snapshot (values[0], error);
+	if (old_values == NULL)
+		return FALSE;
+	new_values = synapticsmst_tool_load_dpcd_snapshot (values[1], error);
+	if (new_values == NULL)
+		return FALSE;
+
+	for (guint32 i = 0; i < DPCD_ADDRESS_SPACE; i++) {
+		if (old_values[i] == new_values[i])
+			continue;
+		if (old_values[i] == DPCD_ABSENT)
+			g_print ("0x%05x: -- -> %02x\n", i, new_values[i]);
+		else if (new_values[i] == DPCD_ABSENT)
+			g_print ("0x%05x: %02x -> --\n", i, old_values[i]);
+		else
+			g_print ("0x%05x: %02x -> %02x\n", i, old_values[i], new_values[i]);
+		changes++;
+	}
+	g_print ("%u registers differ\n", changes);
+	return TRUE;
+}
+
+typedef struct {
+	const gchar		*name;
+	synapticsmst_faults	 faults;
+} SynapticsMSTToolFaultProfile;
+
+/* every profile keeps ~100us per AUX access so timings resemble a real link */
+static const SynapticsMSTToolFaultProfile fault_profiles[] = {
+	{ "clean",		{ .aux_latency = 100 } },
+	{ "slow-link",		{ .aux_latency = 400 } },
+	{ "lossy-aux",		{ .aux_latency = 100, .aux_fail = 2 } },
+	{ "rc-failures",	{ .aux_latency = 100, .rc_fail = 5, .rc_result = UPDC_COMMAND_FAILED } },
+	{ "rc-delays",		{ .aux_latency = 100, .rc_delay = 10, .rc_delay_time = 1000 } },
+	{ "stuck-busy",		{ .aux_latency = 100, .rc_stuck = 1 } },
+};
+
+static gboolean
+synapticsmst_tool_benchmark (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	const gchar *aux_node = synapticsmst_device_aux_node_to_string (0);
+	g_autofree gchar *data = NULL;
+	g_autoptr(GBytes) fw = NULL;
+	guint runs = 5;
+	gsize len;
+
+	if (values[0] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected FILE [RUNS]\n");
+		return FALSE;
+	}
+	if (values[1] != NULL)
+		runs = MAX (strtoul (values[1], NULL, 10), 1);
+	if (!g_file_get_contents (values[0], &data, &len, error))
+		return FALSE;
+	fw = g_bytes_new (data, len);
+
+	/* results must not depend on a calibrated profile of this machine */
+	g_setenv ("SYNAPTICSMST_PROFILE_FILE", "/dev/null", TRUE);
+
+	g_print ("%-12s %8s %10s %8s %8s %10s\n", "PROFILE", "SUCCESS", "MEAN", "RETRIES", "TIMEOUTS", "RECOVERIES");
+	for (guint i = 0; i < G_N_ELEMENTS (fault_profiles); i++) {
+		gdouble elapsed = 0.f;
+		guint n_success = 0;
+		guint retries = 0;
+		guint timeouts = 0;
+		guint recoveries = 0;
+
+		for (guint run = 0; run < runs; run++) {
+			synapticsmst_faults faults = fault_profiles[i].faults;
+			g_autoptr(SynapticsMSTDevice) device = NULL;
+			g_autoptr(GError) error_local = NULL;
+			const SynapticsMSTDeviceStats *stats;
+			gint64 start;
+
+			if (g_cancellable_set_error_if_cancelled (priv->cancellable, error)) {
+				synapticsmst_common_set_faults (NULL);
+				synapticsmst_emulator_detach ();
+				return FALSE;
+			}
+
+			/* a fresh hub holding the same image, and a replayable seed */
+			synapticsmst_emulator_attach (aux_node, (const guint8 *) data, len);
+			faults.seed = run + 1;
+			synapticsmst_common_set_faults (&faults);
+
+			device = synapticsmst_device_new (SYNAPTICSMST_DEVICE_KIND_DIRECT, 0, 0, 0);
+			start = g_get_monotonic_time ();
+			if (synapticsmst_device_write_firmware (device, fw, &error_local))
+				n_success++;
+			else
+				g_debug ("%s run %u: %s", fault_profiles[i].name, run + 1, error_local->message);
+			elapsed += (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+
+			stats = synapticsmst_device_get_stats (device);
+			retries += stats->retries;
+			timeouts += stats->timeouts;
+			recoveries += stats->recoveries;
+			synapticsmst_common_set_faults (NULL);
+			synapticsmst_emulator_detach ();
+		}
+		g_print ("%-12s %7.0f%% %9.2fs %8.1f %8.1f %10.1f\n",
+			 fault_profiles[i].name,
+			 100.f * n_success / runs,
+			 elapsed / runs,
+			 (gdouble) retries / runs,
+			 (gdouble) timeouts / runs,
+			 (gdouble) recoveries / runs);
+	}
+	return TRUE;
+}
+
+static gboolean
+synapticsmst_tool_flash_tree (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	guint8 aux_node;
+	gchar *endptr = NULL;
+	gint64 tmp;
+	g_autoptr(GPtrArray) images = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+	g_autoptr(GPtrArray) devices = g_ptr_array_new ();
+	g_autoptr(GPtrArray) firmwares = g_ptr_array_new ();
+
+	if (values[0] == NULL || values[1] == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid arguments, expected AUX-NODE FILE [FILE...]\n");
+		return FALSE;
+	}
+	tmp = g_ascii_strtoll (values[0], &endptr, 10);
+	if (endptr == values[0] || *endptr != '\0' || tmp < 0 || tmp >= MAX_DP_AUX_NODES) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid DP Aux Node %s\n", values[0]);
+		return FALSE;
+	}
+	aux_node = tmp;
+
+	/* load every image once */
+	for (guint i = 1; values[i] != NULL; i++) {
+		gchar *data = NULL;
+		gsize len;
+		if (!g_file_get_contents (values[i], &data, &len, error)) {
+			return FALSE;
+		}
+		g_ptr_array_add (images, g_bytes_new_take (data, len));
+	}
+
+	/* only the hubs behind the aux node being flashed, so the other nodes
+	 * aren't probed and a hub seen through both can't be deduped away */
+	if (!synapticsmst_tool_scan_aux_node_range (priv, aux_node, aux_node, error)) {
+		return FALSE;
+	}
+
+	/* match each device behind the aux node to an image by board ID */
+	for (guint8 i=0; i<priv->device_array->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (priv->device_array, i);
+		SynapticsMSTDeviceBoardID boardID;
+		GBytes *fw = NULL;
+
+		if (synapticsmst_device_get_aux_node (device) != aux_node) {
+			continue;
+		}
+		if (!synapticsmst_device_ensure_identity (device, priv->cancellable, error)) {
+			return FALSE;
+		}
+		boardID = synapticsmst_device_get_boardID (device);
+		for (guint j = 0; j < images->len; j++) {
+			GBytes *image = g_ptr_array_index (images, j);
+			gsize len;
+			const guint8 *data = g_bytes_get_data (image, &len);
+			if (synapticsmst_image_get_board_id (data, len) == boardID) {
+				fw = image;
+				break;
+			}
+		}
+		if (fw == NULL) {
+			g_print ("[Device %1d] no image for board ID 0x%04x, skipping\n", i+1, boardID);
+			continue;
+		}
+		g_print ("[Device %1d] %s at layer %d\n", i+1,
+			 synapticsmst_device_kind_to_string (synapticsmst_device_get_kind (device)),
+			 synapticsmst_device_get_layer (device));
+		synapticsmst_device_set_progress_func (device, synapticsmst_tool_progress_cb, NULL, NULL);
+		g_ptr_array_add (devices, device);
+		g_ptr_array_add (firmwares, fw);
+	}
+	if (devices->len == 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "No device in DP Aux Node %d matches the firmware\n", aux_node);
+		return FALSE;
+	}
+
+	if (!synapticsmst_device_write_firmware_batch (devices, firmwares, priv->cancellable, error)) {
+		return FALSE;
+	}
+	g_print ("Update Sucessfully. Please reset device to apply new firmware\n");
+	return TRUE;
+}
+
+static void
+synapticsmst_tool_watch_print (const gchar *action, SynapticsMSTDevice *device)
+{
+	const gchar *boardID = synapticsmst_device_boardID_to_string (synapticsmst_device_get_boardID (device));
+
+	g_print ("%s : %s in DP Aux Node %d (layer %d, rad 0x%04x)\n",
+		 action,
+		 synapticsmst_device_kind_to_string (synapticsmst_device_get_kind (device)),
+		 synapticsmst_device_get_aux_node (device),
+		 synapticsmst_device_get_layer (device),
+		 synapticsmst_device_get_rad (device));
+	if (boardID != NULL) {
+		g_print ("Device : %s with Synaptics %s\n", boardID, synapticsmst_device_get_chipID (device));
+		g_print ("Firmware version : %s\n", synapticsmst_device_get_version (device));
+	}
+	else {
+		g_print ("Unknown Device\n");
+	}
+	g_print ("\n");
+}
+
+static void
+synapticsmst_tool_watch_added_cb (SynapticsMSTMonitor *monitor, SynapticsMSTDevice *device, gpointer user_data)
+{
+	synapticsmst_tool_watch_print ("Added", device);
+}
+
+static void
+synapticsmst_tool_watch_removed_cb (SynapticsMSTMonitor *monitor, SynapticsMSTDevice *device, gpointer user_data)
+{
+	synapticsmst_tool_watch_print ("Removed", device);
+}
+
+static void
+synapticsmst_tool_watch_changed_cb (SynapticsMSTMonitor *monitor, SynapticsMSTDevice *device, gpointer user_data)
+{
+	synapticsmst_tool_watch_print ("Changed", device);
+}
+
+static void
+synapticsmst_tool_watch_cancelled_cb (GCancellable *cancellable, gpointer user_data)
+{
+	GMainLoop *loop = (GMainLoop *) user_data;
+	g_main_loop_quit (loop);
+}
+
+static gboolean
+synapticsmst_tool_watch (SynapticsMSTToolPrivate *priv, gchar **values, guint8 device_index, GError **error)
+{
+	g_autoptr(SynapticsMSTMonitor) monitor = synapticsmst_monitor_new ();
+	g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+	gulong cancel_id;
+
+	g_signal_connect (monitor, "device-added",
+			  G_CALLBACK (synapticsmst_tool_watch_added_cb), priv);
+	g_signal_connect (monitor, "device-removed",
+			  G_CALLBACK (synapticsmst_tool_watch_removed_cb), priv);
+	g_signal_connect (monitor, "device-changed",
+			  G_CALLBACK (synapticsmst_tool_watch_changed_cb), priv);
+	if (!synapticsmst_monitor_coldplug (monitor, error)) {
+		return FALSE;
+	}
+
+	/* run until ctrl+c */
+	cancel_id = g_cancellable_connect (priv->cancellable,
+					   G_CALLBACK (synapticsmst_tool_watch_cancelled_cb),
+					   loop, NULL);
+	g_main_loop_run (loop);
+	g_cancellable_disconnect (priv->cancellable, cancel_id);
+	return TRUE;
+}
+
 static gboolean
 synapticsmst_tool_run (SynapticsMSTToolPrivate *priv,
               		   const gchar *command,
@@ -317,6 +1087,247 @@ synapticsmst_tool_run (SynapticsMSTToolPrivate *priv,
         return FALSE;
 }
 
+typedef struct {
+	const gchar	*name;
+	const gchar	*type;
+	const gchar	*help;
+	gsize		 offset;
+	gboolean	 is_uint;
+} SynapticsMSTToolMetric;
+
+static const SynapticsMSTToolMetric synapticsmst_tool_metrics[] = {
+	{ "enumerate_duration_seconds", "gauge", "Time taken to enumerate the device",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, enumerate_time), FALSE },
+	{ "identity_read_latency_seconds", "gauge", "Time taken to read the identity block",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, identity_latency), FALSE },
+	{ "bytes_written_total", "counter", "Bytes written to the SPI flash",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, bytes_written), TRUE },
+	{ "rc_commands_total", "counter", "RC commands issued, including tunnelled ones",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, rc_commands), TRUE },
+	{ "rc_timeouts_total", "counter", "RC commands that timed out",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, timeouts), TRUE },
+	{ "flash_retries_total", "counter", "Flash blocks that were written again",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, retries), TRUE },
+	{ "aux_throttled_seconds_total", "counter", "Time spent waiting for the AUX budget",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, throttle_time), FALSE },
+	{ "rc_recoveries_total", "counter", "Stuck or timed out RC commands recovered in-band",
+	  G_STRUCT_OFFSET (SynapticsMSTDeviceStats, recoveries), TRUE },
+	{ NULL }
+};
+
+static const gchar *
+synapticsmst_tool_metric_format (gchar *buf, const SynapticsMSTDeviceStats *stats, const SynapticsMSTToolMetric *metric)
+{
+	const guint8 *base = (const guint8 *) stats;
+
+	/* never use the locale decimal separator in machine output */
+	if (metric->is_uint) {
+		g_snprintf (buf, G_ASCII_DTOSTR_BUF_SIZE, "%u", *(const guint *) (base + metric->offset));
+		return buf;
+	}
+	return g_ascii_formatd (buf, G_ASCII_DTOSTR_BUF_SIZE, "%.6f", *(const gdouble *) (base + metric->offset));
+}
+
+/* only the identity cached at enumeration, so writing metrics never opens
+ * a session that would show up in the stats being written */
+static gchar *
+synapticsmst_tool_metric_labels (SynapticsMSTDevice *device)
+{
+	const gchar *chip_id = synapticsmst_device_get_chipID (device);
+	return g_strdup_printf ("aux_node=\"%u\",layer=\"%u\",board_id=\"0x%04x\",chip_id=\"%s\"",
+				synapticsmst_device_get_aux_node (device),
+				synapticsmst_device_get_layer (device),
+				synapticsmst_device_get_boardID (device),
+				chip_id != NULL ? chip_id : "unknown");
+}
+
+static gchar *
+synapticsmst_tool_metrics_to_prometheus (GPtrArray *devices, const gchar *command, gboolean success, gdouble duration)
+{
+	GString *str = g_string_new (NULL);
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+	g_autofree gchar *command_safe = g_strescape (command, NULL);
+	g_autoptr(GPtrArray) labels = g_ptr_array_new_with_free_func (g_free);
+
+	for (guint i = 0; i < devices->len; i++)
+		g_ptr_array_add (labels, synapticsmst_tool_metric_labels (g_ptr_array_index (devices, i)));
+
+	g_string_append (str, "# HELP synapticsmst_run_success Whether the last run succeeded\n");
+	g_string_append (str, "# TYPE synapticsmst_run_success gauge\n");
+	g_string_append_printf (str, "synapticsmst_run_success{command=\"%s\"} %i\n", command_safe, success ? 1 : 0);
+	g_string_append (str, "# HELP synapticsmst_run_duration_seconds Time taken by the last run\n");
+	g_string_append (str, "# TYPE synapticsmst_run_duration_seconds gauge\n");
+	g_string_append_printf (str, "synapticsmst_run_duration_seconds{command=\"%s\"} %s\n", command_safe,
+				g_ascii_formatd (buf, sizeof (buf), "%.6f", duration));
+
+	for (guint j = 0; synapticsmst_tool_metrics[j].name != NULL; j++) {
+		const SynapticsMSTToolMetric *metric = &synapticsmst_tool_metrics[j];
+		g_string_append_printf (str, "# HELP synapticsmst_%s %s\n", metric->name, metric->help);
+		g_string_append_printf (str, "# TYPE synapticsmst_%s %s\n", metric->name, metric->type);
+		for (guint i = 0; i < devices->len; i++) {
+			const SynapticsMSTDeviceStats *stats = synapticsmst_device_get_stats (g_ptr_array_index (devices, i));
+			g_string_append_printf (str, "synapticsmst_%s{%s} %s\n", metric->name,
+						(const gchar *) g_ptr_array_index (labels, i),
+						synapticsmst_tool_metric_format (buf, stats, metric));
+		}
+	}
+
+	g_string_append (str, "# HELP synapticsmst_phase_duration_seconds Time taken by each firmware update phase\n");
+	g_string_append (str, "# TYPE synapticsmst_phase_duration_seconds gauge\n");
+	for (guint i = 0; i < devices->len; i++) {
+		const SynapticsMSTDeviceStats *stats = synapticsmst_device_get_stats (g_ptr_array_index (devices, i));
+		for (guint phase = 0; phase < SYNAPTICSMST_DEVICE_PHASE_LAST; phase++) {
+			g_string_append_printf (str, "synapticsmst_phase_duration_seconds{%s,phase=\"%s\"} %s\n",
+						(const gchar *) g_ptr_array_index (labels, i),
+						synapticsmst_device_phase_to_string (phase),
+						g_ascii_formatd (buf, sizeof (buf), "%.6f", stats->phase_time[phase]));
+		}
+	}
+	return g_string_free (str, FALSE);
+}
+
+static gchar *
+synapticsmst_tool_metrics_to_json (GPtrArray *devices, const gchar *command, gboolean success, gdouble duration)
+{
+	GString *str = g_string_new (NULL);
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+	g_autofree gchar *command_safe = g_strescape (command, NULL);
+
+	g_string_append_printf (str, "{\n  \"command\": \"%s\",\n", command_safe);
+	g_string_append_printf (str, "  \"success\": %s,\n", success ? "true" : "false");
+	g_string_append_printf (str, "  \"duration_seconds\": %s,\n",
+				g_ascii_formatd (buf, sizeof (buf), "%.6f", duration));
+	g_string_append (str, "  \"devices\": [");
+	for (guint i = 0; i < devices->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (devices, i);
+		const SynapticsMSTDeviceStats *stats = synapticsmst_device_get_stats (device);
+		const gchar *chip_id = synapticsmst_device_get_chipID (device);
+
+		g_string_append_printf (str, "%s\n    {\n", i > 0 ? "," : "");
+		g_string_append_printf (str, "      \"aux_node\": %u,\n", synapticsmst_device_get_aux_node (device));
+		g_string_append_printf (str, "      \"layer\": %u,\n", synapticsmst_device_get_layer (device));
+		g_string_append_printf (str, "      \"board_id\": \"0x%04x\",\n", synapticsmst_device_get_boardID (device));
+		g_string_append_printf (str, "      \"chip_id\": \"%s\",\n", chip_id != NULL ? chip_id : "unknown");
+		for (guint j = 0; synapticsmst_tool_metrics[j].name != NULL; j++) {
+			g_string_append_printf (str, "      \"%s\": %s,\n", synapticsmst_tool_metrics[j].name,
+						synapticsmst_tool_metric_format (buf, stats, &synapticsmst_tool_metrics[j]));
+		}
+		g_string_append (str, "      \"phase_duration_seconds\": {");
+		for (guint phase = 0; phase < SYNAPTICSMST_DEVICE_PHASE_LAST; phase++) {
+			g_string_append_printf (str, "%s \"%s\": %s", phase > 0 ? "," : "",
+						synapticsmst_device_phase_to_string (phase),
+						g_ascii_formatd (buf, sizeof (buf), "%.6f", stats->phase_time[phase]));
+		}
+		g_string_append (str, " }\n    }");
+	}
+	g_string_append (str, "\n  ]\n}\n");
+	return g_string_free (str, FALSE);
+}
+
+static gboolean
+synapticsmst_tool_write_metrics (SynapticsMSTToolPrivate *priv, const gchar *command, gboolean success, gdouble duration, GError **error)
+{
+	g_autofree gchar *data = NULL;
+	g_autoptr(GPtrArray) devices = g_ptr_array_new ();
+
+	/* only the devices this run actually talked to */
+	for (guint i = 0; priv->device_array != NULL && i < priv->device_array->len; i++) {
+		SynapticsMSTDevice *device = g_ptr_array_index (priv->device_array, i);
+		const SynapticsMSTDeviceStats *stats = synapticsmst_device_get_stats (device);
+		if (stats->rc_commands > 0 || stats->enumerate_time > 0)
+			g_ptr_array_add (devices, device);
+	}
+
+	if (priv->metrics_format == NULL || g_strcmp0 (priv->metrics_format, "prometheus") == 0) {
+		data = synapticsmst_tool_metrics_to_prometheus (devices, command, success, duration);
+	}
+	else if (g_strcmp0 (priv->metrics_format, "json") == 0) {
+		data = synapticsmst_tool_metrics_to_json (devices, command, success, duration);
+	}
+	else {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Unknown metrics format %s\n", priv->metrics_format);
+		return FALSE;
+	}
+
+	/* written atomically, so a scraper never sees half a file */
+	return g_file_set_contents (priv->metrics_file, data, -1, error);
+}
+
+/* hand plain enumerate, checksum, audit and flash requests to a running
+ * broker, which already has the topology and identities cached */
+static gboolean
+synapticsmst_tool_run_in_broker (SynapticsMSTToolPrivate *priv, gint argc, gchar **argv, gboolean *handled, GError **error)
+{
+	const gchar *commands[] = { "enumerate", "checksum", "audit", "flash", NULL };
+	g_autoptr(GString) output = g_string_new (NULL);
+	g_autoptr(GPtrArray) request = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GError) error_local = NULL;
+	gboolean ret;
+
+	*handled = FALSE;
+	if (priv->no_broker || argc < 2 || !g_strv_contains (commands, argv[1]))
+		return TRUE;
+
+	/* anything the broker cannot do, or report on, stays local, and so does
+	 * anything run with transport settings the broker would not apply */
+	if (priv->dry_run || priv->activate || priv->use_repository || priv->metrics_file != NULL ||
+	    priv->transport_options)
+		return TRUE;
+	if (!synapticsmst_broker_is_running ())
+		return TRUE;
+
+	for (gint i = 1; i < argc; i++) {
+		/* the broker does not share our working directory */
+		if (i == 2 && g_strcmp0 (argv[1], "flash") == 0) {
+			g_autoptr(GFile) file = g_file_new_for_commandline_arg (argv[i]);
+			g_ptr_array_add (request, g_file_get_path (file));
+			continue;
+		}
+		g_ptr_array_add (request, g_strdup (argv[i]));
+	}
+	g_ptr_array_add (request, NULL);
+
+	ret = synapticsmst_broker_request ((gchar **) request->pdata, output, priv->cancellable, &error_local);
+	g_print ("%s", output->str);
+	if (!ret && (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) ||
+		     g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED))) {
+		g_debug ("broker not running, scanning locally");
+		return TRUE;
+	}
+	*handled = TRUE;
+	if (!ret) {
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* "200" limits transactions, "200:4096" bytes as well, 0 is unlimited */
+static gboolean
+synapticsmst_tool_set_budget (synapticsmst_traffic traffic, const gchar *text, GError **error)
+{
+	synapticsmst_budget budget = { 0, 0 };
+	guint64 transactions;
+	guint64 bytes = 0;
+	gchar *endptr = NULL;
+
+	if (text == NULL)
+		return TRUE;
+
+	/* parsed wide so a huge value can't wrap into the int budget */
+	transactions = g_ascii_strtoull (text, &endptr, 10);
+	if (*endptr == ':')
+		bytes = g_ascii_strtoull (endptr + 1, &endptr, 10);
+	if (endptr == text || *endptr != '\0' || transactions > G_MAXINT || bytes > G_MAXINT) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid AUX budget %s\n", text);
+		return FALSE;
+	}
+	budget.transactions = transactions;
+	budget.bytes = bytes;
+	synapticsmst_common_set_budget (traffic, &budget);
+	return TRUE;
+}
+
 static gboolean
 synapticsmst_tool_sigint_cb (gpointer user_data)
 {
@@ -331,6 +1342,12 @@ main (int argc, char **argv)
 {
 	gboolean ret;
 	gboolean verbose = FALSE;
+	gboolean handled = FALSE;
+	gint64 start;
+	gint lock_timeout = 0;
+	gint cache_block_size = -1;
+	g_autofree gchar *budget_fg = NULL;
+	g_autofree gchar *budget_bg = NULL;
 	guint8 device_index = 0;
 	g_autofree gchar *cmd_descriptions = NULL;
 	g_autoptr (SynapticsMSTToolPrivate) priv = g_new0 (SynapticsMSTToolPrivate, 1);
@@ -343,6 +1360,26 @@ main (int argc, char **argv)
 			"Specify Major/Minor ID(s) of MST device", "major:minor" },
 		{ "force", '\0', 0, G_OPTION_ARG_NONE, &priv->force,
 			"Force the action ignoring all warnings", NULL },
+		{ "dry-run", '\0', 0, G_OPTION_ARG_NONE, &priv->dry_run,
+			"Estimate the flash duration without writing anything", NULL },
+		{ "no-broker", '\0', 0, G_OPTION_ARG_NONE, &priv->no_broker,
+			"Always scan locally, even if synapticsmst-broker is running", NULL },
+		{ "activate", '\0', 0, G_OPTION_ARG_NONE, &priv->activate,
+			"Reset the device after flashing so the new firmware runs", NULL },
+		{ "repository", '\0', 0, G_OPTION_ARG_NONE, &priv->use_repository,
+			"Flash the newest imported image matching the board ID", NULL },
+		{ "metrics-file", '\0', 0, G_OPTION_ARG_FILENAME, &priv->metrics_file,
+			"Write transport metrics of the run to a file", "FILE" },
+		{ "metrics-format", '\0', 0, G_OPTION_ARG_STRING, &priv->metrics_format,
+			"Format of the metrics file, prometheus or json", "FORMAT" },
+		{ "foreground-budget", '\0', 0, G_OPTION_ARG_STRING, &budget_fg,
+			"AUX budget for flashing, in transactions and bytes per second", "TPS[:BPS]" },
+		{ "background-budget", '\0', 0, G_OPTION_ARG_STRING, &budget_bg,
+			"AUX budget for enumeration and audit, in transactions and bytes per second", "TPS[:BPS]" },
+		{ "lock-timeout", '\0', 0, G_OPTION_ARG_INT, &lock_timeout,
+			"Milliseconds to wait for other users of the DP Aux node", "MS" },
+		{ "cache-block-size", '\0', 0, G_OPTION_ARG_INT, &cache_block_size,
+			"Bytes per cached EEPROM block, or 0 to always read the hub", "BYTES" },
 		{ NULL}
 	};
 
@@ -366,6 +1403,72 @@ main (int argc, char **argv)
 				/* TRANSLATORS: command description */
 				_("Flash firmware file to MST device"),
 				synapticsmst_tool_flash);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "dpcd-dump",
+			       "DEVICE-INDEX RANGES FILE",
+			       /* TRANSLATORS: command description */
+			       _("Save DPCD ranges such as 0x0-0xff,0x500+16 to a snapshot file"),
+			       synapticsmst_tool_dpcd_dump);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "dpcd-diff",
+			       "OLD-FILE NEW-FILE",
+			       /* TRANSLATORS: command description */
+			       _("Show the DPCD registers that differ between two snapshots"),
+			       synapticsmst_tool_dpcd_diff);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "flash-tree",
+			       "AUX-NODE FILE...",
+			       /* TRANSLATORS: command description */
+			       _("Flash every device behind a DP Aux node, downstream first"),
+			       synapticsmst_tool_flash_tree);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "audit",
+			       NULL,
+			       /* TRANSLATORS: command description */
+			       _("Show identity, board ID and flash checksum of all devices"),
+			       synapticsmst_tool_audit);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "benchmark",
+			       "FILE [RUNS]",
+			       /* TRANSLATORS: command description */
+			       _("Flash an emulated hub under each builtin fault profile"),
+			       synapticsmst_tool_benchmark);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "activate",
+			       "DEVICE-INDEX",
+			       /* TRANSLATORS: command description */
+			       _("Reset a device so that newly flashed firmware runs"),
+			       synapticsmst_tool_activate);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "checksum",
+			       "DEVICE-INDEX",
+			       /* TRANSLATORS: command description */
+			       _("Show the checksum of the whole flash of a device"),
+			       synapticsmst_tool_checksum);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "update-region",
+			       "REGION FILE DEVICE-INDEX",
+			       /* TRANSLATORS: command description */
+			       _("Update only the EDID, config or code region of a device"),
+			       synapticsmst_tool_update_region);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "import",
+			       "FILE [VERSION]",
+			       /* TRANSLATORS: command description */
+			       _("Index a firmware image in the local repository"),
+			       synapticsmst_tool_import);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "calibrate",
+			       "DEVICE-INDEX",
+			       /* TRANSLATORS: command description */
+			       _("Measure the fastest reliable transport settings for a board"),
+			       synapticsmst_tool_calibrate);
+	synapticsmst_tool_add (priv->cmd_array,
+			       "watch",
+			       NULL,
+			       /* TRANSLATORS: command description */
+			       _("Watch for Synaptics MST devices being added and removed"),
+			       synapticsmst_tool_watch);
 
 	/* do stuff on ctrl+c */
 	priv->cancellable = g_cancellable_new ();
@@ -397,13 +1500,38 @@ main (int argc, char **argv)
 	if (verbose)
 		g_setenv ("G_MESSAGES_DEBUG", "all", FALSE);
 
+	/* the broker has its own settings, so these mean running locally */
+	priv->transport_options = lock_timeout > 0 || cache_block_size >= 0 || budget_fg != NULL || budget_bg != NULL;
+
+	/* wait longer (or shorter) for other processes using the hub */
+	if (lock_timeout > 0)
+		synapticsmst_common_set_lock_timeout (lock_timeout);
+	if (cache_block_size >= 0)
+		synapticsmst_device_set_cache_block_size (cache_block_size);
+
+	/* share the AUX channel with the displays on the dock */
+	if (!synapticsmst_tool_set_budget (TRAFFIC_FOREGROUND, budget_fg, &error) ||
+	    !synapticsmst_tool_set_budget (TRAFFIC_BACKGROUND, budget_bg, &error)) {
+		g_print ("%s", error->message);
+		return EXIT_FAILURE;
+	}
+
 	/* run the specified command */
 	if (argc == 4)
 	{
 		device_index = strtol (argv[3], NULL, 10);
 	}
 
-	ret = synapticsmst_tool_run (priv, argv[1], (gchar**) &argv[2], device_index, &error);
+	start = g_get_monotonic_time ();
+	ret = synapticsmst_tool_run_in_broker (priv, argc, argv, &handled, &error);
+	if (ret && !handled)
+		ret = synapticsmst_tool_run (priv, argv[1], (gchar**) &argv[2], device_index, &error);
+	if (priv->metrics_file != NULL) {
+		g_autoptr(GError) error_metrics = NULL;
+		gdouble duration = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+		if (!synapticsmst_tool_write_metrics (priv, argv[1] != NULL ? argv[1] : "", ret, duration, &error_metrics))
+			g_printerr ("Failed to write metrics: %s", error_metrics->message);
+	}
 	if (!ret) {
 		g_print ("%s\n", error->message);
 		return EXIT_FAILURE;
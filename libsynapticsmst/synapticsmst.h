@@ -31,6 +31,7 @@
 #define __SYNAPTICSMST_H_INSIDE__
 
 #include <libsynapticsmst/synapticsmst-device.h>
+#include <libsynapticsmst/synapticsmst-monitor.h>
 
 #undef __SYNAPTICSMST_H_INSIDE__
 